@@ -44,10 +44,15 @@ LOCAL_C_INCLUDES := \
 	$(TOP)/hardware/samsung_slsi/exynos5/include
 
 LOCAL_SRC_FILES := 	\
+	alloc_backend.cpp \
+	alloc_stats.cpp \
+	dma_heap_backend.cpp \
 	format_chooser.cpp \
+	format_convert.cpp \
 	gralloc.cpp 	\
 	framebuffer.cpp \
-	mapper.cpp
+	mapper.cpp \
+	plane_layout.cpp
 
 LOCAL_MODULE := gralloc.$(TARGET_BOARD_PLATFORM)
 LOCAL_VENDOR_MODULE := true
@@ -58,6 +63,25 @@ ifeq ($(BOARD_USES_EXYNOS5_GRALLOC_RANGE_FLUSH), true)
 LOCAL_CFLAGS += -DGRALLOC_RANGE_FLUSH
 endif
 
+# Both layouts leave fd1/fd2 unset for planes that live in fd. The HWC,
+# MPP and camera HALs outside this tree still read fd1/fd2 directly, so
+# keep them off until those use getPlaneFd()/getMetadataFd().
+ifeq ($(BOARD_USES_GRALLOC_SINGLE_ALLOC_YUV), true)
+LOCAL_CFLAGS += -DGRALLOC_SINGLE_ALLOC_YUV
+endif
+
+ifeq ($(BOARD_USES_GRALLOC_ALIGN_POLICY), true)
+LOCAL_CFLAGS += -DGRALLOC_ALIGN_POLICY
+endif
+
+ifeq ($(BOARD_USES_GRALLOC_EMBEDDED_PRIV), true)
+LOCAL_CFLAGS += -DGRALLOC_EMBEDDED_PRIV
+endif
+
+ifeq ($(BOARD_USES_GRALLOC_DMA_HEAP), true)
+LOCAL_CFLAGS += -DGRALLOC_DMA_HEAP
+endif
+
 ifeq ($(BOARD_USES_EXYNOS5_CRC_BUFFER_ALLOC), true)
 LOCAL_CFLAGS += -DUSES_EXYNOS_CRC_BUFFER_ALLOC
 endif
@@ -90,3 +114,5 @@ LOCAL_VENDOR_MODULE := true
 LOCAL_MODULE := libGrallocWrapper
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
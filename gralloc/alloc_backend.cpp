@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+
+#include <log/log.h>
+
+#include <hardware/exynos/ion.h>
+#include <linux/ion.h>
+#include <exynos_ion.h>
+
+#include "alloc_backend.h"
+
+/*****************************************************************************/
+
+#ifndef GRALLOC_MEMFD_BACKEND
+
+static bool ion_probe(void)
+{
+    return true;
+}
+
+static int ion_open(void)
+{
+    return exynos_ion_open();
+}
+
+static int ion_alloc(int devfd, size_t size, unsigned int heap_mask, unsigned int flags)
+{
+    int fd = exynos_ion_alloc(devfd, size, heap_mask, flags);
+
+    /* libion returns -1 and leaves the ioctl error in errno */
+    return (fd < 0) ? -errno : fd;
+}
+
+static int ion_import_handle(int devfd, int fd, ion_user_handle_t *handle)
+{
+    return exynos_ion_import_handle(devfd, fd, handle);
+}
+
+static int ion_free_handle(int devfd, ion_user_handle_t handle)
+{
+    return exynos_ion_free_handle(devfd, handle);
+}
+
+static int ion_sync(int devfd, int fd)
+{
+    return exynos_ion_sync_fd(devfd, fd);
+}
+
+static int ion_sync_partial(int devfd, int fd, off_t offset, size_t len)
+{
+    return exynos_ion_sync_fd_partial(devfd, fd, offset, len);
+}
+
+const struct alloc_backend ion_alloc_backend = {
+    .name = "ion",
+    .probe = ion_probe,
+    .open = ion_open,
+    .alloc = ion_alloc,
+    .import_handle = ion_import_handle,
+    .free_handle = ion_free_handle,
+    .sync = ion_sync,
+    .sync_partial = ion_sync_partial,
+};
+
+#endif /* GRALLOC_MEMFD_BACKEND */
+
+/*****************************************************************************/
+
+/* in order of preference, the first one that probes successfully is used */
+static const struct alloc_backend *backends[] = {
+#ifdef GRALLOC_MEMFD_BACKEND
+    /* off-device builds have no ION to fall back to */
+    &memfd_alloc_backend,
+#else
+#ifdef GRALLOC_DMA_HEAP
+    &dma_heap_alloc_backend,
+#endif
+    &ion_alloc_backend,
+#endif
+};
+
+static pthread_once_t backend_once = PTHREAD_ONCE_INIT;
+static const struct alloc_backend *backend;
+
+static void select_backend(void)
+{
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (backends[i]->probe()) {
+            backend = backends[i];
+            break;
+        }
+    }
+    if (!backend)
+        backend = backends[sizeof(backends) / sizeof(backends[0]) - 1];
+
+    ALOGI("using %s allocator backend", backend->name);
+}
+
+const struct alloc_backend *gralloc_backend(void)
+{
+    pthread_once(&backend_once, select_backend);
+    return backend;
+}
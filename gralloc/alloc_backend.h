@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ALLOC_BACKEND_H_
+#define ALLOC_BACKEND_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <linux/ion.h>
+
+/*
+ * Buffer allocator backends. Every call takes the device fd returned by
+ * open (module->ionfd) and the ION heap mask / flags gralloc computes;
+ * backends that are not ION translate them to their own heaps.
+ */
+struct alloc_backend {
+    const char *name;
+    /* returns true if the backend can be used on this device */
+    bool (*probe)(void);
+    int (*open)(void);
+    /* returns the dma-buf fd, or a negative errno */
+    int (*alloc)(int devfd, size_t size, unsigned int heap_mask, unsigned int flags);
+    int (*import_handle)(int devfd, int fd, ion_user_handle_t *handle);
+    int (*free_handle)(int devfd, ion_user_handle_t handle);
+    /* cache maintenance on demand, NULL if the backend has none */
+    int (*sync)(int devfd, int fd);
+    int (*sync_partial)(int devfd, int fd, off_t offset, size_t len);
+    /*
+     * Brackets each CPU lock of fd, usage being the SW bits of the lock,
+     * for backends whose cache maintenance is tied to it; NULL otherwise.
+     */
+    int (*begin_cpu_access)(int devfd, int fd, int usage);
+    int (*end_cpu_access)(int devfd, int fd, int usage);
+};
+
+#ifdef GRALLOC_MEMFD_BACKEND
+extern const struct alloc_backend memfd_alloc_backend;
+#else
+extern const struct alloc_backend ion_alloc_backend;
+#endif
+#ifdef GRALLOC_DMA_HEAP
+extern const struct alloc_backend dma_heap_alloc_backend;
+#endif
+
+const struct alloc_backend *gralloc_backend(void);
+
+static inline int gralloc_backend_open(void)
+{
+    return gralloc_backend()->open();
+}
+
+static inline int gralloc_backend_alloc(int devfd, size_t size,
+                                        unsigned int heap_mask, unsigned int flags)
+{
+    return gralloc_backend()->alloc(devfd, size, heap_mask, flags);
+}
+
+static inline int gralloc_backend_import_handle(int devfd, int fd, ion_user_handle_t *handle)
+{
+    return gralloc_backend()->import_handle(devfd, fd, handle);
+}
+
+static inline int gralloc_backend_free_handle(int devfd, ion_user_handle_t handle)
+{
+    return gralloc_backend()->free_handle(devfd, handle);
+}
+
+static inline int gralloc_backend_sync(int devfd, int fd)
+{
+    if (!gralloc_backend()->sync)
+        return 0;
+    return gralloc_backend()->sync(devfd, fd);
+}
+
+static inline int gralloc_backend_sync_partial(int devfd, int fd, off_t offset, size_t len)
+{
+    if (!gralloc_backend()->sync_partial)
+        return 0;
+    return gralloc_backend()->sync_partial(devfd, fd, offset, len);
+}
+
+static inline int gralloc_backend_begin_cpu_access(int devfd, int fd, int usage)
+{
+    if (!gralloc_backend()->begin_cpu_access)
+        return 0;
+    return gralloc_backend()->begin_cpu_access(devfd, fd, usage);
+}
+
+static inline int gralloc_backend_end_cpu_access(int devfd, int fd, int usage)
+{
+    if (!gralloc_backend()->end_cpu_access)
+        return 0;
+    return gralloc_backend()->end_cpu_access(devfd, fd, usage);
+}
+
+#endif /* ALLOC_BACKEND_H_ */
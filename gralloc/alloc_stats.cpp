@@ -0,0 +1,327 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include <log/log.h>
+
+#include "gralloc_priv.h"
+#include "gr.h"
+#include "alloc_stats.h"
+
+#define NELEM(x) (sizeof(x) / sizeof((x)[0]))
+
+/* heap masks and formats seen beyond these land in the last slot */
+#define STATS_MAX_HEAPS     8
+#define STATS_MAX_FORMATS   32
+#define STATS_OTHER         -1
+
+enum usage_class {
+    USAGE_CLASS_UI,
+    USAGE_CLASS_CAMERA,
+    USAGE_CLASS_VIDEO,
+    USAGE_CLASS_PROTECTED,
+    USAGE_CLASS_COUNT,
+};
+
+static const char *const usage_class_names[USAGE_CLASS_COUNT] = {
+    "ui", "camera", "video", "protected",
+};
+
+/* upper bounds of the latency histogram buckets in us, the last is open */
+static const unsigned int latency_bounds_us[] = {
+    50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000,
+};
+#define LATENCY_BUCKETS (NELEM(latency_bounds_us) + 1)
+
+struct live_stats {
+    uint64_t bytes;
+    uint64_t peak_bytes;
+    unsigned int buffers;
+};
+
+struct heap_stats {
+    int heap_mask;      /* STATS_OTHER for the overflow slot */
+    uint64_t bytes;     /* allocated from this heap so far */
+    unsigned int allocs;
+    unsigned int failures;
+    unsigned int latency[LATENCY_BUCKETS];
+};
+
+struct format_stats {
+    int format;         /* STATS_OTHER for the overflow slot */
+    struct live_stats live;
+    unsigned int failures;
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct live_stats total;
+static struct live_stats classes[USAGE_CLASS_COUNT];
+static struct heap_stats heaps[STATS_MAX_HEAPS];
+static unsigned int nheaps;
+static struct format_stats formats[STATS_MAX_FORMATS];
+static unsigned int nformats;
+static unsigned int class_failures[USAGE_CLASS_COUNT];
+static unsigned int dpb_fallbacks;
+static unsigned int dpb_fallback_failures;
+
+static enum usage_class _usage_class(int usage)
+{
+    if (usage & GRALLOC_USAGE_PROTECTED)
+        return USAGE_CLASS_PROTECTED;
+    if (usage & (GRALLOC_USAGE_HW_CAMERA_MASK | GRALLOC_USAGE_CAMERA_RESERVED |
+                 GRALLOC_USAGE_SECURE_CAMERA_RESERVED))
+        return USAGE_CLASS_CAMERA;
+    if (usage & (GRALLOC_USAGE_HW_VIDEO_ENCODER | GRALLOC_USAGE_VIDEO_EXT))
+        return USAGE_CLASS_VIDEO;
+    return USAGE_CLASS_UI;
+}
+
+static size_t _allocated_bytes(const private_handle_t *hnd)
+{
+    size_t bytes = roundUpToPageSize(hnd->size);
+
+    if (hnd->getPackedPlanes())
+        return bytes;
+    if (hnd->fd1 >= 0)
+        bytes += roundUpToPageSize(hnd->size1);
+    if (hnd->fd2 >= 0)
+        bytes += roundUpToPageSize(hnd->size2);
+    return bytes;
+}
+
+/* must be called with stats_lock held */
+static struct heap_stats *_heap_locked(unsigned int heap_mask)
+{
+    for (unsigned int i = 0; i < nheaps; i++)
+        if (heaps[i].heap_mask == (int)heap_mask)
+            return &heaps[i];
+
+    if (nheaps < STATS_MAX_HEAPS - 1) {
+        heaps[nheaps].heap_mask = heap_mask;
+        return &heaps[nheaps++];
+    }
+
+    nheaps = STATS_MAX_HEAPS;
+    heaps[STATS_MAX_HEAPS - 1].heap_mask = STATS_OTHER;
+    return &heaps[STATS_MAX_HEAPS - 1];
+}
+
+/* must be called with stats_lock held */
+static struct format_stats *_format_locked(int format)
+{
+    for (unsigned int i = 0; i < nformats; i++)
+        if (formats[i].format == format)
+            return &formats[i];
+
+    if (nformats < STATS_MAX_FORMATS - 1) {
+        formats[nformats].format = format;
+        return &formats[nformats++];
+    }
+
+    nformats = STATS_MAX_FORMATS;
+    formats[STATS_MAX_FORMATS - 1].format = STATS_OTHER;
+    return &formats[STATS_MAX_FORMATS - 1];
+}
+
+static inline void _live_add(struct live_stats *live, size_t bytes)
+{
+    live->bytes += bytes;
+    live->buffers++;
+    if (live->bytes > live->peak_bytes)
+        live->peak_bytes = live->bytes;
+}
+
+static inline void _live_sub(struct live_stats *live, size_t bytes)
+{
+    live->bytes -= (bytes < live->bytes) ? bytes : live->bytes;
+    if (live->buffers)
+        live->buffers--;
+}
+
+void gralloc_stats_add_buffer(const private_handle_t *hnd)
+{
+    size_t bytes = _allocated_bytes(hnd);
+
+    pthread_mutex_lock(&stats_lock);
+    _live_add(&_format_locked(hnd->format)->live, bytes);
+    _live_add(&classes[_usage_class(hnd->flags)], bytes);
+    _live_add(&total, bytes);
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void gralloc_stats_remove_buffer(const private_handle_t *hnd)
+{
+    size_t bytes = _allocated_bytes(hnd);
+
+    pthread_mutex_lock(&stats_lock);
+    _live_sub(&_format_locked(hnd->format)->live, bytes);
+    _live_sub(&classes[_usage_class(hnd->flags)], bytes);
+    _live_sub(&total, bytes);
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void gralloc_stats_heap(unsigned int heap_mask, size_t bytes, uint64_t latency_ns)
+{
+    uint64_t latency_us = latency_ns / 1000;
+    unsigned int bucket = 0;
+
+    while ((bucket < NELEM(latency_bounds_us)) && (latency_us >= latency_bounds_us[bucket]))
+        bucket++;
+
+    pthread_mutex_lock(&stats_lock);
+    struct heap_stats *heap = _heap_locked(heap_mask);
+    if (bytes) {
+        heap->bytes += bytes;
+        heap->allocs++;
+    } else {
+        heap->failures++;
+    }
+    heap->latency[bucket]++;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void gralloc_stats_failure(int usage, int format)
+{
+    pthread_mutex_lock(&stats_lock);
+    _format_locked(format)->failures++;
+    class_failures[_usage_class(usage)]++;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void gralloc_stats_dpb_fallback(bool succeeded)
+{
+    pthread_mutex_lock(&stats_lock);
+    dpb_fallbacks++;
+    if (!succeeded)
+        dpb_fallback_failures++;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * snprintf that keeps appending at len. Once buff is full it only counts,
+ * so len ends up as the length needed, like snprintf's return value.
+ */
+#define APPEND(buff, buff_len, len, ...) \
+    do { \
+        int _room = (len) < (buff_len) ? (buff_len) - (len) : 0; \
+        (len) += snprintf(_room ? (buff) + (len) : NULL, _room, __VA_ARGS__); \
+    } while (0)
+
+int gralloc_stats_dump(char *buff, int buff_len)
+{
+    int len = 0;
+
+    pthread_mutex_lock(&stats_lock);
+    APPEND(buff, buff_len, len,
+           "allocations: %u buffers, %" PRIu64 " KB live, %" PRIu64 " KB peak\n",
+           total.buffers, total.bytes / 1024, total.peak_bytes / 1024);
+
+    for (unsigned int i = 0; i < USAGE_CLASS_COUNT; i++)
+        APPEND(buff, buff_len, len,
+               "  %-9s %5u buffers %9" PRIu64 " KB live %9" PRIu64 " KB peak %5u failures\n",
+               usage_class_names[i], classes[i].buffers, classes[i].bytes / 1024,
+               classes[i].peak_bytes / 1024, class_failures[i]);
+
+    for (unsigned int i = 0; i < nheaps; i++) {
+        const struct heap_stats *heap = &heaps[i];
+
+        APPEND(buff, buff_len, len,
+               "  heap %#010x %5u allocs %9" PRIu64 " KB allocated %5u failures\n"
+               "    latency us:",
+               heap->heap_mask, heap->allocs, heap->bytes / 1024, heap->failures);
+        for (unsigned int b = 0; b < LATENCY_BUCKETS; b++) {
+            if (b < NELEM(latency_bounds_us))
+                APPEND(buff, buff_len, len, " <%u:%u", latency_bounds_us[b], heap->latency[b]);
+            else
+                APPEND(buff, buff_len, len, " >=%u:%u\n", latency_bounds_us[b - 1], heap->latency[b]);
+        }
+    }
+
+    for (unsigned int i = 0; i < nformats; i++) {
+        const struct format_stats *fmt = &formats[i];
+
+        if (!fmt->live.peak_bytes && !fmt->failures)
+            continue;
+        APPEND(buff, buff_len, len,
+               "  format %#06x %5u buffers %9" PRIu64 " KB live %9" PRIu64 " KB peak %5u failures\n",
+               fmt->format, fmt->live.buffers, fmt->live.bytes / 1024,
+               fmt->live.peak_bytes / 1024, fmt->failures);
+    }
+
+    APPEND(buff, buff_len, len, "  protected DPB fallbacks: %u, %u failed\n",
+           dpb_fallbacks, dpb_fallback_failures);
+    pthread_mutex_unlock(&stats_lock);
+
+    return len;
+}
+
+static int _dump_live_json(char *buff, int buff_len, int len, const struct live_stats *live)
+{
+    APPEND(buff, buff_len, len,
+           "\"buffers\":%u,\"live_bytes\":%" PRIu64 ",\"peak_bytes\":%" PRIu64,
+           live->buffers, live->bytes, live->peak_bytes);
+    return len;
+}
+
+int gralloc_stats_dump_json(char *buff, int buff_len)
+{
+    int len = 0;
+
+    pthread_mutex_lock(&stats_lock);
+    APPEND(buff, buff_len, len, "{\"total\":{");
+    len = _dump_live_json(buff, buff_len, len, &total);
+
+    APPEND(buff, buff_len, len, "},\"usage_classes\":{");
+    for (unsigned int i = 0; i < USAGE_CLASS_COUNT; i++) {
+        APPEND(buff, buff_len, len, "%s\"%s\":{", i ? "," : "", usage_class_names[i]);
+        len = _dump_live_json(buff, buff_len, len, &classes[i]);
+        APPEND(buff, buff_len, len, ",\"failures\":%u}", class_failures[i]);
+    }
+
+    APPEND(buff, buff_len, len, "},\"heaps\":[");
+    for (unsigned int i = 0; i < nheaps; i++) {
+        const struct heap_stats *heap = &heaps[i];
+
+        APPEND(buff, buff_len, len,
+               "%s{\"heap_mask\":%d,\"allocs\":%u,\"allocated_bytes\":%" PRIu64
+               ",\"failures\":%u,\"latency_us\":[",
+               i ? "," : "", heap->heap_mask, heap->allocs, heap->bytes, heap->failures);
+        for (unsigned int b = 0; b < NELEM(latency_bounds_us); b++)
+            APPEND(buff, buff_len, len, "{\"lt\":%u,\"count\":%u},",
+                   latency_bounds_us[b], heap->latency[b]);
+        APPEND(buff, buff_len, len, "{\"lt\":null,\"count\":%u}",
+               heap->latency[LATENCY_BUCKETS - 1]);
+        APPEND(buff, buff_len, len, "]}");
+    }
+
+    APPEND(buff, buff_len, len, "],\"formats\":[");
+    for (unsigned int i = 0; i < nformats; i++) {
+        const struct format_stats *fmt = &formats[i];
+
+        APPEND(buff, buff_len, len, "%s{\"format\":%d,", i ? "," : "", fmt->format);
+        len = _dump_live_json(buff, buff_len, len, &fmt->live);
+        APPEND(buff, buff_len, len, ",\"failures\":%u}", fmt->failures);
+    }
+
+    APPEND(buff, buff_len, len, "],\"dpb_fallbacks\":%u,\"dpb_fallback_failures\":%u}\n",
+           dpb_fallbacks, dpb_fallback_failures);
+    pthread_mutex_unlock(&stats_lock);
+
+    return len;
+}
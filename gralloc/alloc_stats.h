@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ALLOC_STATS_H_
+#define ALLOC_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Per-process allocation accounting.
+ *
+ * Buffers this process holds: live bytes per usage class and format, and
+ * peak watermarks. A buffer is added when it is allocated here or
+ * registered (imported) here, and removed on free or unregister. Under
+ * Treble the allocator service frees every buffer right after handing it
+ * out, so the live numbers are the ones of the client processes.
+ *
+ * Allocations made by this process: per heap the buffers and bytes it
+ * actually handed out, a latency histogram and failed attempts, one count
+ * per attempt on that heap, fallback hops included.
+ *
+ * gralloc_stats_dump() is the text appended to alloc_device_t::dump (and so
+ * IAllocator::dumpDebugInfo), gralloc_stats_dump_json() the same numbers as
+ * one JSON object, returned by GRALLOC_MODULE_PERFORM_DUMP_STATS. Both
+ * return the length they needed, like snprintf, so a NULL buff with
+ * buff_len 0 sizes the dump.
+ */
+
+struct private_handle_t;
+
+void gralloc_stats_add_buffer(const struct private_handle_t *hnd);
+void gralloc_stats_remove_buffer(const struct private_handle_t *hnd);
+/* one allocation attempt on heap_mask, bytes is 0 if it failed */
+void gralloc_stats_heap(unsigned int heap_mask, size_t bytes, uint64_t latency_ns);
+void gralloc_stats_failure(int usage, int format);
+/* GRALLOC_USAGE_PROTECTED_DPB retried with the MFC output region */
+void gralloc_stats_dpb_fallback(bool succeeded);
+
+int gralloc_stats_dump(char *buff, int buff_len);
+int gralloc_stats_dump_json(char *buff, int buff_len);
+
+#endif /* ALLOC_STATS_H_ */
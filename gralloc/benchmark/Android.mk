@@ -0,0 +1,112 @@
+# Copyright (C) 2013 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+LOCAL_PATH := $(call my-dir)
+
+gralloc_benchmark_src_files := \
+	../alloc_backend.cpp \
+	../alloc_stats.cpp \
+	../dma_heap_backend.cpp \
+	../format_chooser.cpp \
+	../format_convert.cpp \
+	../framebuffer.cpp \
+	../gralloc.cpp \
+	../mapper.cpp \
+	../memfd_backend.cpp \
+	../plane_layout.cpp
+
+gralloc_benchmark_c_includes := \
+	$(LOCAL_PATH)/.. \
+	$(LOCAL_PATH)/../../include \
+	$(TOP)/hardware/samsung_slsi/exynos/include \
+	$(TOP)/hardware/samsung_slsi/exynos5/include
+
+gralloc_benchmark_cflags := \
+	-DLOG_TAG=\"gralloc_benchmark\" -Wno-missing-field-initializers \
+	-DUSES_EXYNOS_COMMON_GRALLOC -DMALI_AFBC_GRALLOC=1
+
+# The allocator backend and layout flags the board selects
+gralloc_benchmark_device_cflags := $(gralloc_benchmark_cflags)
+
+ifeq ($(BOARD_USES_EXYNOS5_GRALLOC_RANGE_FLUSH), true)
+gralloc_benchmark_device_cflags += -DGRALLOC_RANGE_FLUSH
+endif
+
+ifeq ($(BOARD_USES_GRALLOC_SINGLE_ALLOC_YUV), true)
+gralloc_benchmark_device_cflags += -DGRALLOC_SINGLE_ALLOC_YUV
+endif
+
+ifeq ($(BOARD_USES_GRALLOC_ALIGN_POLICY), true)
+gralloc_benchmark_device_cflags += -DGRALLOC_ALIGN_POLICY
+endif
+
+ifeq ($(BOARD_USES_GRALLOC_EMBEDDED_PRIV), true)
+gralloc_benchmark_device_cflags += -DGRALLOC_EMBEDDED_PRIV
+endif
+
+ifeq ($(BOARD_USES_GRALLOC_DMA_HEAP), true)
+gralloc_benchmark_device_cflags += -DGRALLOC_DMA_HEAP
+endif
+
+# Device builds, run on the allocator backend the board selects
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := gralloc_benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_VENDOR_MODULE := true
+LOCAL_SRC_FILES := $(gralloc_benchmark_src_files) gralloc_benchmark.cpp
+LOCAL_C_INCLUDES := $(gralloc_benchmark_c_includes)
+LOCAL_CFLAGS := $(gralloc_benchmark_device_cflags)
+LOCAL_SHARED_LIBRARIES := liblog libcutils libion_exynos libutils libsync libhardware libion
+LOCAL_HEADER_LIBRARIES := libhardware_headers
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := gralloc_convert_benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_VENDOR_MODULE := true
+LOCAL_SRC_FILES := $(gralloc_benchmark_src_files) convert_benchmark.cpp
+LOCAL_C_INCLUDES := $(gralloc_benchmark_c_includes)
+LOCAL_CFLAGS := $(gralloc_benchmark_device_cflags)
+LOCAL_SHARED_LIBRARIES := liblog libcutils libion_exynos libutils libsync libhardware libion
+LOCAL_HEADER_LIBRARIES := libhardware_headers
+
+include $(BUILD_EXECUTABLE)
+
+# Host builds on the memfd backend, no ION needed
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := gralloc_benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := $(gralloc_benchmark_src_files) gralloc_benchmark.cpp
+LOCAL_C_INCLUDES := $(gralloc_benchmark_c_includes)
+LOCAL_CFLAGS := $(gralloc_benchmark_cflags) -DGRALLOC_MEMFD_BACKEND -DPAGE_SIZE=4096
+LOCAL_SHARED_LIBRARIES := liblog libcutils libutils
+LOCAL_HEADER_LIBRARIES := libhardware_headers
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := gralloc_convert_benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := $(gralloc_benchmark_src_files) convert_benchmark.cpp
+LOCAL_C_INCLUDES := $(gralloc_benchmark_c_includes)
+LOCAL_CFLAGS := $(gralloc_benchmark_cflags) -DGRALLOC_MEMFD_BACKEND -DPAGE_SIZE=4096
+LOCAL_SHARED_LIBRARIES := liblog libcutils libutils
+LOCAL_HEADER_LIBRARIES := libhardware_headers
+
+include $(BUILD_HOST_EXECUTABLE)
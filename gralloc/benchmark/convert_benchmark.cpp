@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Throughput of the format_convert.cpp kernels on buffers allocated and
+ * locked through gralloc, so every conversion runs on the real strides,
+ * vstrides and plane offsets of the Exynos layouts.
+ *
+ *   convert_benchmark [-n iterations] [-f conversion] [-c]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <log/log.h>
+
+#include <hardware/hardware.h>
+#include <hardware/gralloc.h>
+
+#include "gralloc_priv.h"
+#include "exynos_format.h"
+#include "format_convert.h"
+
+extern struct private_module_t HAL_MODULE_INFO_SYM;
+
+#define SW_USAGE (GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN)
+
+enum convert_op {
+    OP_NV_TO_RGBA,
+    OP_RGBA_TO_NV,
+    OP_PLANAR_TO_NV,
+    OP_NV_TO_PLANAR,
+    OP_S10B_TO_P010,
+    OP_P010_TO_RGBA1010102,
+    OP_RGBA1010102_TO_P010,
+};
+
+struct bench_convert {
+    const char *name;
+    enum convert_op op;
+    int src_format;
+    int dst_format;
+};
+
+static const struct bench_convert conversions[] = {
+    { "NV21M->RGBA",           OP_NV_TO_RGBA,          HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M,
+                                                       HAL_PIXEL_FORMAT_RGBA_8888 },
+    { "NV12M->RGBA",           OP_NV_TO_RGBA,          HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M,
+                                                       HAL_PIXEL_FORMAT_RGBA_8888 },
+    { "NV12N->RGBA",           OP_NV_TO_RGBA,          HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN,
+                                                       HAL_PIXEL_FORMAT_RGBA_8888 },
+    { "RGBA->NV21M",           OP_RGBA_TO_NV,          HAL_PIXEL_FORMAT_RGBA_8888,
+                                                       HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M },
+    { "YV12->NV21M",           OP_PLANAR_TO_NV,        HAL_PIXEL_FORMAT_YV12,
+                                                       HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M },
+    { "YV12M->NV21M",          OP_PLANAR_TO_NV,        HAL_PIXEL_FORMAT_EXYNOS_YV12_M,
+                                                       HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M },
+    { "NV21M->YV12",           OP_NV_TO_PLANAR,        HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M,
+                                                       HAL_PIXEL_FORMAT_YV12 },
+    { "NV12M_S10B->P010M",     OP_S10B_TO_P010,        HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B,
+                                                       HAL_PIXEL_FORMAT_EXYNOS_YCbCr_P010_M },
+    { "NV12N_S10B->P010M",     OP_S10B_TO_P010,        HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_S10B,
+                                                       HAL_PIXEL_FORMAT_EXYNOS_YCbCr_P010_M },
+    { "P010M->RGBA_1010102",   OP_P010_TO_RGBA1010102, HAL_PIXEL_FORMAT_EXYNOS_YCbCr_P010_M,
+                                                       HAL_PIXEL_FORMAT_RGBA_1010102 },
+    { "RGBA_1010102->P010M",   OP_RGBA1010102_TO_P010, HAL_PIXEL_FORMAT_RGBA_1010102,
+                                                       HAL_PIXEL_FORMAT_EXYNOS_YCbCr_P010_M },
+};
+
+struct bench_resolution {
+    int w;
+    int h;
+};
+
+static const struct bench_resolution resolutions[] = {
+    { 640, 480 },
+    { 1280, 720 },
+    { 1920, 1080 },
+    { 3840, 2160 },
+};
+
+#define NELEM(x) (sizeof(x) / sizeof((x)[0]))
+
+/* a gralloc buffer locked for CPU access */
+struct bench_buffer {
+    buffer_handle_t handle;
+    bool rgb;
+    uint8_t *rgba;
+    int rgba_stride;
+    struct gralloc_yuv_image yuv;
+};
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t percentile(std::vector<uint64_t> &samples, int pct)
+{
+    if (samples.empty())
+        return 0;
+
+    size_t i = (samples.size() - 1) * pct / 100;
+    std::nth_element(samples.begin(), samples.begin() + i, samples.end());
+    return samples[i];
+}
+
+static bool is_rgb(int format)
+{
+    return (format == HAL_PIXEL_FORMAT_RGBA_8888) || (format == HAL_PIXEL_FORMAT_RGBA_1010102);
+}
+
+static int alloc_buffer(alloc_device_t *dev, int w, int h, int format, struct bench_buffer *buf)
+{
+    gralloc_module_t const *module = &HAL_MODULE_INFO_SYM.base;
+    private_handle_t *hnd;
+    int stride;
+
+    memset(buf, 0, sizeof(*buf));
+    if (dev->alloc(dev, w, h, format, SW_USAGE, &buf->handle, &stride))
+        return -1;
+    module->registerBuffer(module, buf->handle);
+    hnd = (private_handle_t *)buf->handle;
+    buf->rgb = is_rgb(format);
+
+    if (buf->rgb) {
+        void *vaddr;
+
+        if (module->lock(module, buf->handle, SW_USAGE, 0, 0, w, h, &vaddr))
+            return -1;
+        buf->rgba = (uint8_t *)vaddr;
+        buf->rgba_stride = stride * 4;
+        return 0;
+    }
+
+    android_ycbcr ycbcr;
+    if (module->lock_ycbcr(module, buf->handle, SW_USAGE, 0, 0, w, h, &ycbcr))
+        return -1;
+    return gralloc_yuv_image_from_handle(hnd, &buf->yuv);
+}
+
+static void free_buffer(alloc_device_t *dev, struct bench_buffer *buf)
+{
+    gralloc_module_t const *module = &HAL_MODULE_INFO_SYM.base;
+
+    if (!buf->handle)
+        return;
+    module->unlock(module, buf->handle);
+    module->unregisterBuffer(module, buf->handle);
+    dev->free(dev, buf->handle);
+}
+
+static void fill_source(struct bench_buffer *buf, int w, int h)
+{
+    if (buf->rgb) {
+        for (int y = 0; y < h; y++)
+            for (int x = 0; x < w * 4; x++)
+                buf->rgba[y * buf->rgba_stride + x] = (x * 7 + y * 13) & 0xff;
+        return;
+    }
+
+    /* whatever the layout, fill every byte a conversion may read */
+    struct gralloc_yuv_image *img = &buf->yuv;
+    int row_bytes = w * ((img->c_step == 4) ? 2 : 1);
+    for (int y = 0; y < h; y++)
+        memset(img->y + y * img->y_stride, (y * 3) & 0xff, row_bytes);
+    if (img->y2b)
+        for (int y = 0; y < h; y++)
+            memset(img->y2b + y * img->y2b_stride, 0x1b, (w + 3) / 4);
+    if (img->c2b)
+        for (int y = 0; y < (h + 1) / 2; y++)
+            memset(img->c2b + y * img->c2b_stride, 0xe4, (w + 3) / 4);
+}
+
+static int run_one(const bench_convert &conv, const bench_buffer &src, const bench_buffer &dst)
+{
+    switch (conv.op) {
+    case OP_NV_TO_RGBA:
+        return gralloc_convert_nv_to_rgba(&src.yuv, false, dst.rgba, dst.rgba_stride);
+    case OP_RGBA_TO_NV:
+        return gralloc_convert_rgba_to_nv(src.rgba, src.rgba_stride, &dst.yuv);
+    case OP_PLANAR_TO_NV:
+        return gralloc_convert_planar_to_nv(&src.yuv, &dst.yuv);
+    case OP_NV_TO_PLANAR:
+        return gralloc_convert_nv_to_planar(&src.yuv, &dst.yuv);
+    case OP_S10B_TO_P010:
+        return gralloc_convert_s10b_to_p010(&src.yuv, &dst.yuv);
+    case OP_P010_TO_RGBA1010102:
+        return gralloc_convert_p010_to_rgba1010102(&src.yuv, dst.rgba, dst.rgba_stride);
+    case OP_RGBA1010102_TO_P010:
+        return gralloc_convert_rgba1010102_to_p010(src.rgba, src.rgba_stride, &dst.yuv);
+    }
+    return -1;
+}
+
+/* returns the number of failed iterations */
+static int run_conversion(alloc_device_t *dev, const bench_convert &conv,
+                          const bench_resolution &res, int iterations, bool csv)
+{
+    struct bench_buffer src, dst;
+    std::vector<uint64_t> samples;
+    int failed = 0;
+
+    if (alloc_buffer(dev, res.w, res.h, conv.src_format, &src) ||
+        alloc_buffer(dev, res.w, res.h, conv.dst_format, &dst)) {
+        fprintf(stderr, "%s %dx%d: could not allocate and lock buffers\n", conv.name, res.w, res.h);
+        free_buffer(dev, &src);
+        free_buffer(dev, &dst);
+        return iterations;
+    }
+    fill_source(&src, res.w, res.h);
+
+    for (int i = 0; i < iterations; i++) {
+        uint64_t t0 = now_ns();
+        if (run_one(conv, src, dst)) {
+            failed++;
+            continue;
+        }
+        samples.push_back(now_ns() - t0);
+    }
+
+    free_buffer(dev, &src);
+    free_buffer(dev, &dst);
+
+    uint64_t p50 = percentile(samples, 50), p99 = percentile(samples, 99);
+    double mpix = p50 ? (double)res.w * res.h * 1000.0 / p50 : 0.0;
+
+    if (csv)
+        printf("%s,%dx%d,%" PRIu64 ",%" PRIu64 ",%.1f\n", conv.name, res.w, res.h, p50, p99, mpix);
+    else
+        printf("%-21s %5dx%-5d %9.2f %9.2f %9.1f\n", conv.name, res.w, res.h,
+               p50 / 1000000.0, p99 / 1000000.0, mpix);
+
+    return failed;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n iterations] [-f conversion] [-c]\n", prog);
+    fprintf(stderr, "  -n  iterations per conversion/resolution (default 20)\n");
+    fprintf(stderr, "  -f  only run conversions whose name contains this string\n");
+    fprintf(stderr, "  -c  print csv, times in ns\n");
+}
+
+int main(int argc, char **argv)
+{
+    alloc_device_t *dev;
+    const char *filter = NULL;
+    int iterations = 20;
+    bool csv = false;
+    int failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:f:ch")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            case 'c':
+                csv = true;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (iterations <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (gralloc_open(&HAL_MODULE_INFO_SYM.base.common, &dev)) {
+        fprintf(stderr, "failed to open gralloc device\n");
+        return 1;
+    }
+
+    if (csv)
+        printf("conversion,resolution,p50_ns,p99_ns,mpix_per_s\n");
+    else
+        printf("%-21s %11s %9s %9s %9s\n", "conversion", "size", "p50 ms", "p99 ms", "Mpix/s");
+
+    for (size_t c = 0; c < NELEM(conversions); c++) {
+        if (filter && !strstr(conversions[c].name, filter))
+            continue;
+        for (size_t r = 0; r < NELEM(resolutions); r++)
+            failed += run_conversion(dev, conversions[c], resolutions[r], iterations, csv);
+    }
+
+    gralloc_close(dev);
+
+    if (failed)
+        fprintf(stderr, "%d iterations failed\n", failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,407 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Sweeps the formats handled by gralloc_alloc_rgb/gralloc_alloc_yuv over a
+ * few resolutions and usages and times alloc, register, the first lock
+ * (map + sync), the first pass over the mapped planes, a second lock (sync
+ * only), unlock, unregister and free. The page faults taken during that
+ * first pass are counted too; prefaulted mappings take them in lock1.
+ * Also reports how many bytes each format loses to alignment and ext_size
+ * padding compared with the tightly packed image.
+ *
+ * Built against the module sources directly. The host build uses the
+ * memfd backend, so it runs on any Linux box; the device build uses
+ * whatever allocator backend the board selects.
+ *
+ *   gralloc_benchmark [-n iterations] [-f format] [-c]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <log/log.h>
+
+#include <hardware/hardware.h>
+#include <hardware/gralloc.h>
+
+#include "gralloc_priv.h"
+#include "exynos_format.h"
+#include "gr.h"
+
+extern struct private_module_t HAL_MODULE_INFO_SYM;
+
+struct bench_format {
+    int format;
+    const char *name;
+    /* bits per pixel of the tightly packed image */
+    int bits;
+    bool ycbcr;
+};
+
+static const struct bench_format formats[] = {
+    { HAL_PIXEL_FORMAT_RGBA_8888,                   "RGBA_8888",    32, false },
+    { HAL_PIXEL_FORMAT_RGBX_8888,                   "RGBX_8888",    32, false },
+    { HAL_PIXEL_FORMAT_BGRA_8888,                   "BGRA_8888",    32, false },
+    { HAL_PIXEL_FORMAT_EXYNOS_ARGB_8888,            "ARGB_8888",    32, false },
+    { HAL_PIXEL_FORMAT_RGBA_1010102,                "RGBA_1010102", 32, false },
+    { HAL_PIXEL_FORMAT_RGBA_FP16,                   "RGBA_FP16",    64, false },
+    { HAL_PIXEL_FORMAT_RGB_888,                     "RGB_888",      24, false },
+    { HAL_PIXEL_FORMAT_RGB_565,                     "RGB_565",      16, false },
+    { HAL_PIXEL_FORMAT_RAW16,                       "RAW16",        16, false },
+    { HAL_PIXEL_FORMAT_BLOB,                        "BLOB",          8, false },
+    { HAL_PIXEL_FORMAT_YV12,                        "YV12",         12, true },
+    { HAL_PIXEL_FORMAT_YCrCb_420_SP,                "NV21",         12, true },
+    { HAL_PIXEL_FORMAT_Y8,                          "Y8",            8, true },
+    { HAL_PIXEL_FORMAT_Y16,                         "Y16",          16, true },
+    { HAL_PIXEL_FORMAT_YCbCr_422_I,                 "YUYV",         16, true },
+    { HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_P_M,        "I420M",        12, true },
+    { HAL_PIXEL_FORMAT_EXYNOS_YV12_M,               "YV12M",        12, true },
+    { HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M,       "NV12M",        12, true },
+    { HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M,       "NV21M",        12, true },
+    { HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN,        "NV12N",        12, true },
+    { HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_PRIV,  "NV12M_PRIV",   12, true },
+    { HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B,  "NV12M_S10B",   15, true },
+    { HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_S10B,   "NV12N_S10B",   15, true },
+    { HAL_PIXEL_FORMAT_EXYNOS_YCbCr_P010_M,         "P010M",        24, true },
+};
+
+struct bench_resolution {
+    int w;
+    int h;
+};
+
+static const struct bench_resolution resolutions[] = {
+    { 176, 144 },
+    { 640, 480 },
+    { 1280, 720 },
+    { 1920, 1080 },
+    { 3840, 2160 },
+};
+
+struct bench_usage {
+    const char *name;
+    int usage;
+};
+
+static const struct bench_usage usages[] = {
+    { "sw",      GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN },
+    { "gpu",     GRALLOC_USAGE_HW_TEXTURE | GRALLOC_USAGE_HW_RENDER |
+                 GRALLOC_USAGE_SW_READ_RARELY | GRALLOC_USAGE_SW_WRITE_RARELY },
+    { "camera",  GRALLOC_USAGE_HW_CAMERA_WRITE | GRALLOC_USAGE_SW_READ_OFTEN },
+    { "encoder", GRALLOC_USAGE_HW_VIDEO_ENCODER | GRALLOC_USAGE_SW_WRITE_OFTEN },
+    /* no CPU access: decoder output/UI layers, AFBC when the board allows it */
+    { "display", GRALLOC_USAGE_HW_TEXTURE | GRALLOC_USAGE_HW_COMPOSER },
+};
+
+#define NELEM(x) (sizeof(x) / sizeof((x)[0]))
+
+enum {
+    STAT_ALLOC,
+    STAT_REGISTER,
+    STAT_LOCK_FIRST,
+    STAT_TOUCH,
+    STAT_LOCK,
+    STAT_UNLOCK,
+    STAT_UNREGISTER,
+    STAT_FREE,
+    NUM_STATS,
+};
+
+static const char *stat_names[NUM_STATS] = {
+    "alloc", "register", "lock1", "touch", "lock", "unlock", "unreg", "free",
+};
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t percentile(std::vector<uint64_t> &samples, int pct)
+{
+    if (samples.empty())
+        return 0;
+
+    size_t i = (samples.size() - 1) * pct / 100;
+    std::nth_element(samples.begin(), samples.begin() + i, samples.end());
+    return samples[i];
+}
+
+static size_t allocated_bytes(const private_handle_t *hnd)
+{
+    /* what the allocator really hands out, one page-rounded buffer per fd */
+    size_t bytes = roundUpToPageSize(hnd->size);
+
+    if (hnd->getPackedPlanes())
+        return bytes;
+    if (hnd->fd1 >= 0)
+        bytes += roundUpToPageSize(hnd->size1);
+    if (hnd->fd2 >= 0)
+        bytes += roundUpToPageSize(hnd->size2);
+    return bytes;
+}
+
+static uint64_t minor_faults(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+/* reads one byte of every page of the mapped planes, the first CPU pass */
+static void touch_planes(const private_handle_t *hnd)
+{
+    const struct {
+        uint64_t base;
+        int size;
+    } planes[] = {
+        { hnd->base, hnd->size },
+        { hnd->getPackedPlanes() ? 0 : hnd->base1, hnd->size1 },
+        { (hnd->getPackedPlanes() || hnd->getEmbeddedMetadataOffset()) ? 0 : hnd->base2, hnd->size2 },
+    };
+    unsigned int sum = 0;
+
+    for (size_t i = 0; i < sizeof(planes) / sizeof(planes[0]); i++) {
+        const volatile unsigned char *p =
+            (const volatile unsigned char *)(unsigned long)planes[i].base;
+        if (!p)
+            continue;
+        for (int off = 0; off < planes[i].size; off += PAGE_SIZE)
+            sum += p[off];
+    }
+    (void)sum;
+}
+
+static int lock_buffer(gralloc_module_t const *module, const bench_format &fmt,
+                       buffer_handle_t handle, int usage, int w, int h)
+{
+    if (fmt.ycbcr) {
+        android_ycbcr ycbcr;
+        return module->lock_ycbcr(module, handle, usage, 0, 0, w, h, &ycbcr);
+    } else {
+        void *vaddr;
+        return module->lock(module, handle, usage, 0, 0, w, h, &vaddr);
+    }
+}
+
+/* returns the number of failed iterations */
+static int run_one(alloc_device_t *dev, const bench_format &fmt, const bench_resolution &res,
+                   const bench_usage &use, int iterations, bool csv)
+{
+    gralloc_module_t const *module = &HAL_MODULE_INFO_SYM.base;
+    int w = res.w, h = res.h;
+    int lock_usage = use.usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK);
+    std::vector<uint64_t> samples[NUM_STATS];
+    std::vector<uint64_t> faults;
+    size_t ideal, allocated = 0;
+    int failed = 0;
+
+    /* BLOB is a byte buffer, w is its size in bytes */
+    if (fmt.format == HAL_PIXEL_FORMAT_BLOB) {
+        w = res.w * res.h;
+        h = 1;
+    }
+    ideal = (size_t)w * h * fmt.bits / 8;
+
+    for (int i = 0; i < iterations; i++) {
+        buffer_handle_t handle;
+        int stride;
+        uint64_t t0, t1;
+
+        t0 = now_ns();
+        if (dev->alloc(dev, w, h, fmt.format, use.usage, &handle, &stride)) {
+            failed++;
+            continue;
+        }
+        t1 = now_ns();
+        samples[STAT_ALLOC].push_back(t1 - t0);
+        allocated = allocated_bytes((const private_handle_t *)handle);
+
+        t0 = now_ns();
+        module->registerBuffer(module, handle);
+        t1 = now_ns();
+        samples[STAT_REGISTER].push_back(t1 - t0);
+
+        if (lock_usage) {
+            uint64_t f0;
+
+            t0 = now_ns();
+            if (lock_buffer(module, fmt, handle, lock_usage, w, h))
+                failed++;
+            t1 = now_ns();
+            samples[STAT_LOCK_FIRST].push_back(t1 - t0);
+
+            f0 = minor_faults();
+            t0 = now_ns();
+            touch_planes((const private_handle_t *)handle);
+            t1 = now_ns();
+            samples[STAT_TOUCH].push_back(t1 - t0);
+            faults.push_back(minor_faults() - f0);
+            module->unlock(module, handle);
+
+            t0 = now_ns();
+            lock_buffer(module, fmt, handle, lock_usage, w, h);
+            t1 = now_ns();
+            samples[STAT_LOCK].push_back(t1 - t0);
+
+            t0 = now_ns();
+            module->unlock(module, handle);
+            t1 = now_ns();
+            samples[STAT_UNLOCK].push_back(t1 - t0);
+        }
+
+        t0 = now_ns();
+        module->unregisterBuffer(module, handle);
+        t1 = now_ns();
+        samples[STAT_UNREGISTER].push_back(t1 - t0);
+
+        t0 = now_ns();
+        dev->free(dev, handle);
+        t1 = now_ns();
+        samples[STAT_FREE].push_back(t1 - t0);
+    }
+
+    if (samples[STAT_ALLOC].empty()) {
+        printf(csv ? "%s,%dx%d,%s,failed\n" : "%-13s %5dx%-5d %-8s failed\n",
+               fmt.name, res.w, res.h, use.name);
+        return failed;
+    }
+
+    if (csv) {
+        printf("%s,%dx%d,%s,%zu,%zu", fmt.name, res.w, res.h, use.name, ideal, allocated);
+        for (int s = 0; s < NUM_STATS; s++)
+            printf(",%" PRIu64 ",%" PRIu64 ",%" PRIu64, percentile(samples[s], 50),
+                   percentile(samples[s], 90), percentile(samples[s], 99));
+        printf(",%" PRIu64 "\n", percentile(faults, 50));
+    } else {
+        printf("%-13s %5dx%-5d %-8s %8zu %6.1f%%", fmt.name, res.w, res.h, use.name,
+               allocated / 1024, ideal ? 100.0 * ((double)allocated - ideal) / ideal : 0.0);
+        printf(" %7.1f/%-7.1f", percentile(samples[STAT_ALLOC], 50) / 1000.0,
+               percentile(samples[STAT_ALLOC], 99) / 1000.0);
+        for (int s = STAT_REGISTER; s < NUM_STATS; s++)
+            printf(" %7.1f", percentile(samples[s], 50) / 1000.0);
+        printf(" %7" PRIu64 "\n", percentile(faults, 50));
+    }
+
+    return failed;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n iterations] [-f format] [-c] [-j]\n", prog);
+    fprintf(stderr, "  -n  iterations per format/resolution/usage (default 50)\n");
+    fprintf(stderr, "  -f  only run formats whose name contains this string\n");
+    fprintf(stderr, "  -c  print csv, times in ns\n");
+    fprintf(stderr, "  -j  print the module's allocation statistics as json at the end\n");
+}
+
+int main(int argc, char **argv)
+{
+    alloc_device_t *dev;
+    const char *filter = NULL;
+    int iterations = 50;
+    bool csv = false;
+    bool json = false;
+    int failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:f:cjh")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            case 'c':
+                csv = true;
+                break;
+            case 'j':
+                json = true;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (iterations <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (gralloc_open(&HAL_MODULE_INFO_SYM.base.common, &dev)) {
+        fprintf(stderr, "failed to open gralloc device\n");
+        return 1;
+    }
+
+    if (csv) {
+        printf("format,resolution,usage,ideal_bytes,allocated_bytes");
+        for (int s = 0; s < NUM_STATS; s++)
+            printf(",%s_p50,%s_p90,%s_p99", stat_names[s], stat_names[s], stat_names[s]);
+        printf(",faults_p50\n");
+    } else {
+        printf("%-13s %11s %-8s %8s %7s %15s", "format", "size", "usage", "KB", "waste",
+               "alloc p50/p99");
+        for (int s = STAT_REGISTER; s < NUM_STATS; s++)
+            printf(" %7s", stat_names[s]);
+        printf(" %7s\n%71s(all times in us, p50 unless noted)\n", "faults", "");
+    }
+
+    for (size_t f = 0; f < NELEM(formats); f++) {
+        if (filter && !strstr(formats[f].name, filter))
+            continue;
+        for (size_t r = 0; r < NELEM(resolutions); r++)
+            for (size_t u = 0; u < NELEM(usages); u++)
+                failed += run_one(dev, formats[f], resolutions[r], usages[u], iterations, csv);
+    }
+
+    if (!csv) {
+        char buff[4096];
+
+        buff[0] = '\0';
+        if (dev->dump)
+            dev->dump(dev, buff, sizeof(buff));
+        if (buff[0])
+            printf("\n%s", buff);
+    }
+
+    if (json) {
+        gralloc_module_t const *module = &HAL_MODULE_INFO_SYM.base;
+        char buff[8192];
+
+        if (module->perform(module, GRALLOC_MODULE_PERFORM_DUMP_STATS, buff, (int)sizeof(buff)) > 0)
+            printf("%s", buff);
+    }
+
+    gralloc_close(dev);
+
+    if (failed)
+        fprintf(stderr, "%d iterations failed\n", failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef GRALLOC_DMA_HEAP
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#include <sys/ioctl.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+
+#include <log/log.h>
+
+#include <hardware/gralloc.h>
+#include <hardware/exynos/ion.h>
+#include <linux/ion.h>
+#include <exynos_ion.h>
+
+#include "alloc_backend.h"
+
+#define DMA_HEAP_DEV_DIR "/dev/dma_heap"
+
+/* heap names can be overridden per board */
+#ifndef DMA_HEAP_NAME_MFC_OUTPUT
+#define DMA_HEAP_NAME_MFC_OUTPUT "vframe-secure"
+#endif
+#ifndef DMA_HEAP_NAME_VIDEO_EXT
+#define DMA_HEAP_NAME_VIDEO_EXT "vstream-secure"
+#endif
+#ifndef DMA_HEAP_NAME_VIDEO_EXT2
+#define DMA_HEAP_NAME_VIDEO_EXT2 "vscaler-secure"
+#endif
+#ifndef DMA_HEAP_NAME_FIMD_VIDEO
+#define DMA_HEAP_NAME_FIMD_VIDEO "vfw-secure"
+#endif
+#ifndef DMA_HEAP_NAME_G2D_WFD
+#define DMA_HEAP_NAME_G2D_WFD "g2d_wfd"
+#endif
+
+struct dma_heap_desc {
+    unsigned int heap_mask;
+    /* ION region flag the heap stands for, 0 for a whole ION heap */
+    unsigned int region;
+    const char *cached_name;
+    const char *uncached_name;
+};
+
+/*
+ * ION heap masks from _select_heap and the dma-buf heaps they map onto.
+ * The contiguous ION heap is carved into regions picked by flag; each
+ * region is a heap of its own here, and a contiguous allocation with no
+ * region flag we know fails rather than landing in the wrong one.
+ */
+static const struct dma_heap_desc dma_heaps[] = {
+    { ION_HEAP_SYSTEM_MASK,          0, "system",         "system-uncached" },
+    { EXYNOS_ION_HEAP_CAMERA,        0, "camera",         "camera" },
+    { EXYNOS_ION_HEAP_CRYPTO_MASK,   0, "crypto",         "crypto" },
+    { EXYNOS_ION_HEAP_SECURE_CAMERA, 0, "secure_camera",  "secure_camera" },
+    { ION_HEAP_EXYNOS_CONTIG_MASK,   ION_EXYNOS_MFC_OUTPUT_MASK,
+      DMA_HEAP_NAME_MFC_OUTPUT,  DMA_HEAP_NAME_MFC_OUTPUT },
+    { ION_HEAP_EXYNOS_CONTIG_MASK,   (unsigned int)ION_EXYNOS_VIDEO_EXT_MASK,
+      DMA_HEAP_NAME_VIDEO_EXT,   DMA_HEAP_NAME_VIDEO_EXT },
+    { ION_HEAP_EXYNOS_CONTIG_MASK,   ION_EXYNOS_VIDEO_EXT2_MASK,
+      DMA_HEAP_NAME_VIDEO_EXT2,  DMA_HEAP_NAME_VIDEO_EXT2 },
+    { ION_HEAP_EXYNOS_CONTIG_MASK,   ION_EXYNOS_FIMD_VIDEO_MASK,
+      DMA_HEAP_NAME_FIMD_VIDEO,  DMA_HEAP_NAME_FIMD_VIDEO },
+    { ION_HEAP_EXYNOS_CONTIG_MASK,   ION_EXYNOS_G2D_WFD_MASK,
+      DMA_HEAP_NAME_G2D_WFD,     DMA_HEAP_NAME_G2D_WFD },
+};
+
+#define NUM_DMA_HEAPS (sizeof(dma_heaps) / sizeof(dma_heaps[0]))
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+/* lazily opened heap nodes, [i][0] cached and [i][1] uncached */
+static int heap_fds[NUM_DMA_HEAPS][2];
+static pthread_once_t heap_fds_once = PTHREAD_ONCE_INIT;
+
+static void dma_heap_init_fds(void)
+{
+    for (size_t i = 0; i < NUM_DMA_HEAPS; i++)
+        heap_fds[i][0] = heap_fds[i][1] = -1;
+}
+
+static int dma_heap_get_fd(int devfd, unsigned int heap_mask, unsigned int flags)
+{
+    int fd = -ENODEV;
+    bool cached = !!(flags & ION_FLAG_CACHED);
+
+    pthread_once(&heap_fds_once, dma_heap_init_fds);
+
+    for (size_t i = 0; i < NUM_DMA_HEAPS; i++) {
+        if (dma_heaps[i].heap_mask != heap_mask)
+            continue;
+        if (dma_heaps[i].region && !(flags & dma_heaps[i].region))
+            continue;
+
+        pthread_mutex_lock(&heap_lock);
+        fd = heap_fds[i][cached ? 0 : 1];
+        if (fd < 0) {
+            const char *name = cached ? dma_heaps[i].cached_name : dma_heaps[i].uncached_name;
+
+            fd = openat(devfd, name, O_RDONLY | O_CLOEXEC);
+            /* fall back to the cached heap if there is no uncached variant */
+            if (fd < 0 && !cached)
+                fd = openat(devfd, dma_heaps[i].cached_name, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                ALOGE("%s: could not open heap %s: %s", __func__, name, strerror(errno));
+                fd = -errno;
+            } else {
+                heap_fds[i][cached ? 0 : 1] = fd;
+            }
+        }
+        pthread_mutex_unlock(&heap_lock);
+        break;
+    }
+
+    if (fd == -ENODEV)
+        ALOGE("%s: no dma-buf heap for heap_mask %#x flags %#x", __func__, heap_mask, flags);
+
+    return fd;
+}
+
+static bool dma_heap_probe(void)
+{
+    return access(DMA_HEAP_DEV_DIR "/system", R_OK) == 0;
+}
+
+static int dma_heap_open(void)
+{
+    return open(DMA_HEAP_DEV_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static int dma_heap_alloc(int devfd, size_t size, unsigned int heap_mask, unsigned int flags)
+{
+    struct dma_heap_allocation_data data;
+    /* heaps hand out zeroed memory, ION_FLAG_NOZEROED only saves time on ION */
+    int heapfd = dma_heap_get_fd(devfd, heap_mask, flags);
+
+    if (heapfd < 0)
+        return heapfd;
+
+    memset(&data, 0, sizeof(data));
+    data.len = size;
+    data.fd_flags = O_RDWR | O_CLOEXEC;
+
+    if (ioctl(heapfd, DMA_HEAP_IOCTL_ALLOC, &data) < 0) {
+        ALOGE("%s: failed to allocate %zu bytes (heap_mask %#x, flags %#x): %s",
+              __func__, size, heap_mask, flags, strerror(errno));
+        return -errno;
+    }
+
+    return data.fd;
+}
+
+/* dma-buf heaps have no per-process handle to import */
+static int dma_heap_import_handle(int __unused devfd, int __unused fd, ion_user_handle_t *handle)
+{
+    *handle = 0;
+    return 0;
+}
+
+static int dma_heap_free_handle(int __unused devfd, ion_user_handle_t __unused handle)
+{
+    return 0;
+}
+
+/*
+ * Cache maintenance of a dma-buf is tied to the CPU access bracket, so
+ * START goes out when a buffer is locked and END when it is unlocked,
+ * for the direction of the lock. Nothing is left to do on sync.
+ */
+static int dma_heap_cpu_access(int fd, int usage, unsigned int start_end)
+{
+    struct dma_buf_sync sync;
+
+    sync.flags = start_end;
+    if (usage & GRALLOC_USAGE_SW_READ_MASK)
+        sync.flags |= DMA_BUF_SYNC_READ;
+    if (usage & GRALLOC_USAGE_SW_WRITE_MASK)
+        sync.flags |= DMA_BUF_SYNC_WRITE;
+    /* no SW bits: the caller still gets a CPU address, assume both */
+    if (!(sync.flags & DMA_BUF_SYNC_RW))
+        sync.flags |= DMA_BUF_SYNC_RW;
+
+    if (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) < 0) {
+        ALOGE("%s: DMA_BUF_IOCTL_SYNC(%#llx) failed on fd %d: %s", __func__,
+              (unsigned long long)sync.flags, fd, strerror(errno));
+        return -errno;
+    }
+
+    return 0;
+}
+
+static int dma_heap_begin_cpu_access(int __unused devfd, int fd, int usage)
+{
+    return dma_heap_cpu_access(fd, usage, DMA_BUF_SYNC_START);
+}
+
+static int dma_heap_end_cpu_access(int __unused devfd, int fd, int usage)
+{
+    return dma_heap_cpu_access(fd, usage, DMA_BUF_SYNC_END);
+}
+
+const struct alloc_backend dma_heap_alloc_backend = {
+    .name = "dma-heap",
+    .probe = dma_heap_probe,
+    .open = dma_heap_open,
+    .alloc = dma_heap_alloc,
+    .import_handle = dma_heap_import_handle,
+    .free_handle = dma_heap_free_handle,
+    .begin_cpu_access = dma_heap_begin_cpu_access,
+    .end_cpu_access = dma_heap_end_cpu_access,
+};
+
+#endif /* GRALLOC_DMA_HEAP */
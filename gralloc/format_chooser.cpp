@@ -20,46 +20,68 @@
 #include <log/log.h>
 #include <cutils/properties.h>
 #include <hardware/gralloc.h>
+#include "gralloc_priv.h"
+#include "exynos_format.h"
 #include "format_chooser.h"
 
 #define FBT (GRALLOC_USAGE_HW_FB | GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_COMPOSER)
 #define GENERAL_UI (GRALLOC_USAGE_HW_TEXTURE | GRALLOC_USAGE_HW_COMPOSER)
 
 #ifdef USES_EXYNOS_AFBC_FEATURE
+/*
+ * Which usage combinations may get an AFBC buffer, per format. A buffer is
+ * compressed when at least one of its usage bits is in `allowed` (the
+ * producer or consumer that wants AFBC) and none is in `denied` or
+ * AFBC_DENIED_ALWAYS (something that can only handle linear buffers).
+ *
+ * AFBC disabled for 2 and 3 byte formats because
+ * 2,3 byte formats + AFBC + 64byte align not yet compatible with DPU.
+ */
+struct afbc_policy {
+	int format;
+	int allowed;
+	int denied;
+};
+
+/* the MFC (HW_VIDEO_ENCODER, VIDEO_EXT, PROTECTED_DPB) can't read or write AFBC */
+#define AFBC_DENIED_ALWAYS (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK | \
+			    GRALLOC_USAGE_PROTECTED | GRALLOC_USAGE_HW_VIDEO_ENCODER | \
+			    GRALLOC_USAGE_VIDEO_EXT | GRALLOC_USAGE_PROTECTED_DPB)
+
+static const struct afbc_policy afbc_policies[] = {
+	/* FBT and General UI */
+	{ HAL_PIXEL_FORMAT_RGBA_8888,	FBT | GENERAL_UI,	0 },
+	{ HAL_PIXEL_FORMAT_BGRA_8888,	FBT | GENERAL_UI,	0 },
+	{ HAL_PIXEL_FORMAT_RGBX_8888,	FBT | GENERAL_UI,	0 },
+	/* HDR UI */
+	{ HAL_PIXEL_FORMAT_RGBA_1010102,	FBT | GENERAL_UI,	0 },
+	/* DPU can't scan out FP16, only GPU render-to-texture */
+	{ HAL_PIXEL_FORMAT_RGBA_FP16,	GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_TEXTURE,
+					GRALLOC_USAGE_HW_FB | GRALLOC_USAGE_HW_COMPOSER },
+};
+
 /* It's for compression check format, width, usage*/
 int check_for_compression(int w, int h, int format, int usage)
 {
-	switch(format)
+	const struct afbc_policy *policy = NULL;
+
+	for (size_t i = 0; i < sizeof(afbc_policies) / sizeof(afbc_policies[0]); i++)
 	{
-		/* AFBC disabled for 2 and 3 byte formats because
-		 * 2,3 byte formats + AFBC + 64byte align not yet compatible with DPU.
-		 */
-		case HAL_PIXEL_FORMAT_RGB_565:
-		case HAL_PIXEL_FORMAT_RGB_888:
-			return 0;
-		case HAL_PIXEL_FORMAT_RGBA_8888:
-		case HAL_PIXEL_FORMAT_BGRA_8888:
-		case HAL_PIXEL_FORMAT_RGBX_8888:
-		case HAL_PIXEL_FORMAT_YV12:
+		if (afbc_policies[i].format == format)
 		{
-			if (usage & GRALLOC_USAGE_PROTECTED)
-				return 0;
-			if ((w <= 192) || (h <= 192)) /* min restriction for performance */
-				return 0;
-			if( (usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK)) != 0 || usage == 0 )
-				return 0;
-			if (usage & GRALLOC_USAGE_HW_VIDEO_ENCODER)
-				return 0;
-			if ((usage & FBT) || (usage & GENERAL_UI)) /*only support FBT and General UI */
-				return 1;
-			else
-				return 0;
-
+			policy = &afbc_policies[i];
 			break;
 		}
 	}
 
-	return 0;
+	if (policy == NULL)
+		return 0;
+	if ((w <= 192) || (h <= 192)) /* min restriction for performance */
+		return 0;
+	if (usage & (AFBC_DENIED_ALWAYS | policy->denied))
+		return 0;
+
+	return (usage & policy->allowed) ? 1 : 0;
 }
 #else
 int check_for_compression(__unused int w, __unused int h, __unused int format, __unused int usage)
@@ -0,0 +1,896 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#if defined(GRALLOC_CONVERT_NO_SIMD)
+/* plain C only, what the SIMD paths are checked against */
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CONVERT_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CONVERT_SSE2
+#endif
+
+#include <log/log.h>
+
+#include <hardware/gralloc.h>
+
+#include "gralloc_priv.h"
+#include "exynos_format.h"
+#include "format_convert.h"
+#include "plane_layout.h"
+
+static inline uint8_t *plane_base(const private_handle_t *hnd, int plane)
+{
+    switch (plane) {
+    case 0:
+        return (uint8_t *)(unsigned long)hnd->base;
+    case 1:
+        return (uint8_t *)(unsigned long)hnd->base1;
+    case 2:
+        return (uint8_t *)(unsigned long)hnd->base2;
+    default:
+        return NULL;
+    }
+}
+
+int gralloc_yuv_image_from_handle(const private_handle_t *hnd, struct gralloc_yuv_image *img)
+{
+    uint8_t *base = plane_base(hnd, 0);
+    struct gralloc_layout layout;
+
+    memset(img, 0, sizeof(*img));
+    img->width = hnd->width;
+    img->height = hnd->height;
+
+    if (!base)
+        return -EINVAL;
+
+    gralloc_ycbcr_layout(hnd, &layout);
+    if (!layout.ystride || (layout.cb_plane < 0))
+        return -EINVAL;
+
+    img->y = base;
+    img->y_stride = layout.ystride;
+    img->cb = plane_base(hnd, layout.cb_plane);
+    if (!img->cb)
+        return -EINVAL;
+    img->cb += layout.cb_offset;
+    img->c_stride = layout.cstride;
+    img->c_step = layout.cstep;
+
+    if (hnd->format == HAL_PIXEL_FORMAT_EXYNOS_YCbCr_P010_M) {
+        /*
+         * lock_ycbcr reports P010 strides in samples and the metadata
+         * plane as cr; the converters want bytes and the interleaved cr.
+         */
+        img->y_stride *= 2;
+        img->c_stride *= 2;
+        img->c_step *= 2;
+        img->cr = img->cb + 2;
+        return 0;
+    }
+
+    if (layout.cr_plane < 0)
+        return -EINVAL;
+    img->cr = plane_base(hnd, layout.cr_plane);
+    if (!img->cr)
+        return -EINVAL;
+    img->cr += layout.cr_offset;
+
+    /* S10B: the 2-bit planes are in plane 0 and in the chroma plane */
+    if (layout.stride2b) {
+        img->y2b = base + layout.y2b_offset;
+        img->y2b_stride = layout.stride2b;
+        img->c2b = plane_base(hnd, layout.cb_plane) + layout.c2b_offset;
+        img->c2b_stride = layout.stride2b;
+    }
+
+    return 0;
+}
+
+static inline bool is_nv(const struct gralloc_yuv_image *img)
+{
+    return (img->c_step == 2) && ((img->cr == img->cb + 1) || (img->cb == img->cr + 1));
+}
+
+static inline bool is_planar(const struct gralloc_yuv_image *img)
+{
+    return img->c_step == 1;
+}
+
+static inline bool is_p010(const struct gralloc_yuv_image *img)
+{
+    return (img->c_step == 4) && ((img->cr == img->cb + 2) || (img->cb == img->cr + 2));
+}
+
+static inline uint8_t clamp8(int v)
+{
+    return (v < 0) ? 0 : ((v > 255) ? 255 : v);
+}
+
+static inline int clamp10(int v)
+{
+    return (v < 0) ? 0 : ((v > 1023) ? 1023 : v);
+}
+
+/*****************************************************************************/
+
+/* BT.601 in 6-bit fixed point, small enough for 16-bit SIMD lanes */
+struct yuv_coeffs {
+    int16_t y_off;
+    int16_t y_mul;
+    int16_t rv;
+    int16_t gu;
+    int16_t gv;
+    int16_t bu;
+};
+
+static const struct yuv_coeffs bt601_narrow = { 16, 74, 102, 25, 52, 129 };
+static const struct yuv_coeffs bt601_full = { 0, 64, 90, 22, 46, 113 };
+
+static inline void yuv_to_rgba(const struct yuv_coeffs *k, int y, int u, int v, uint8_t *p)
+{
+    int yy = (y - k->y_off) * k->y_mul + 32;
+
+    u -= 128;
+    v -= 128;
+    p[0] = clamp8((yy + k->rv * v) >> 6);
+    p[1] = clamp8((yy - k->gu * u - k->gv * v) >> 6);
+    p[2] = clamp8((yy + k->bu * u) >> 6);
+    p[3] = 0xff;
+}
+
+/*
+ * Converts as many pixels of the row as the SIMD loop handles and returns
+ * that count. The 16-bit intermediates saturate exactly where the scalar
+ * result would clamp, so both paths produce identical output.
+ */
+#if defined(CONVERT_NEON)
+static int nv_row_to_rgba_simd(const struct yuv_coeffs *k, const uint8_t *y, const uint8_t *uv,
+                               bool vu_order, uint8_t *dst, int w)
+{
+    const int16x8_t y_off = vdupq_n_s16(k->y_off);
+    const int16x8_t c128 = vdupq_n_s16(128);
+    const int16x8_t c32 = vdupq_n_s16(32);
+    int x = 0;
+
+    for (; x + 16 <= w; x += 16) {
+        uint8x16_t y8 = vld1q_u8(y + x);
+        uint8x8x2_t c = vld2_u8(uv + x);
+        uint8x8x2_t u2 = vzip_u8(c.val[vu_order ? 1 : 0], c.val[vu_order ? 1 : 0]);
+        uint8x8x2_t v2 = vzip_u8(c.val[vu_order ? 0 : 1], c.val[vu_order ? 0 : 1]);
+        uint8x8_t r8[2], g8[2], b8[2];
+
+        for (int i = 0; i < 2; i++) {
+            int16x8_t yy = vreinterpretq_s16_u16(vmovl_u8(i ? vget_high_u8(y8) : vget_low_u8(y8)));
+            int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u2.val[i])), c128);
+            int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v2.val[i])), c128);
+
+            yy = vqaddq_s16(vmulq_n_s16(vsubq_s16(yy, y_off), k->y_mul), c32);
+            r8[i] = vqmovun_s16(vshrq_n_s16(vqaddq_s16(yy, vmulq_n_s16(v, k->rv)), 6));
+            g8[i] = vqmovun_s16(vshrq_n_s16(vqsubq_s16(vqsubq_s16(yy, vmulq_n_s16(u, k->gu)),
+                                                       vmulq_n_s16(v, k->gv)), 6));
+            b8[i] = vqmovun_s16(vshrq_n_s16(vqaddq_s16(yy, vmulq_n_s16(u, k->bu)), 6));
+        }
+
+        uint8x16x4_t px;
+        px.val[0] = vcombine_u8(r8[0], r8[1]);
+        px.val[1] = vcombine_u8(g8[0], g8[1]);
+        px.val[2] = vcombine_u8(b8[0], b8[1]);
+        px.val[3] = vdupq_n_u8(0xff);
+        vst4q_u8(dst + x * 4, px);
+    }
+
+    return x;
+}
+#elif defined(CONVERT_SSE2)
+static int nv_row_to_rgba_simd(const struct yuv_coeffs *k, const uint8_t *y, const uint8_t *uv,
+                               bool vu_order, uint8_t *dst, int w)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo16 = _mm_set1_epi32(0xffff);
+    const __m128i c128 = _mm_set1_epi16(128);
+    const __m128i c32 = _mm_set1_epi16(32);
+    const __m128i alpha = _mm_set1_epi8((char)0xff);
+    const __m128i y_off = _mm_set1_epi16(k->y_off);
+    const __m128i y_mul = _mm_set1_epi16(k->y_mul);
+    const __m128i rv = _mm_set1_epi16(k->rv);
+    const __m128i gu = _mm_set1_epi16(k->gu);
+    const __m128i gv = _mm_set1_epi16(k->gv);
+    const __m128i bu = _mm_set1_epi16(k->bu);
+    int x = 0;
+
+    for (; x + 8 <= w; x += 8) {
+        __m128i yy = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(y + x)), zero);
+        __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(uv + x)), zero);
+        /* duplicate each chroma sample for the two pixels sharing it */
+        __m128i c0 = _mm_and_si128(c, lo16);
+        __m128i c1 = _mm_srli_epi32(c, 16);
+        c0 = _mm_sub_epi16(_mm_or_si128(c0, _mm_slli_epi32(c0, 16)), c128);
+        c1 = _mm_sub_epi16(_mm_or_si128(c1, _mm_slli_epi32(c1, 16)), c128);
+        __m128i u = vu_order ? c1 : c0;
+        __m128i v = vu_order ? c0 : c1;
+
+        yy = _mm_adds_epi16(_mm_mullo_epi16(_mm_sub_epi16(yy, y_off), y_mul), c32);
+        __m128i r = _mm_srai_epi16(_mm_adds_epi16(yy, _mm_mullo_epi16(v, rv)), 6);
+        __m128i g = _mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(yy, _mm_mullo_epi16(u, gu)),
+                                                  _mm_mullo_epi16(v, gv)), 6);
+        __m128i b = _mm_srai_epi16(_mm_adds_epi16(yy, _mm_mullo_epi16(u, bu)), 6);
+
+        __m128i rg = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_packus_epi16(g, g));
+        __m128i ba = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), alpha);
+        _mm_storeu_si128((__m128i *)(dst + x * 4), _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i *)(dst + x * 4 + 16), _mm_unpackhi_epi16(rg, ba));
+    }
+
+    return x;
+}
+#else
+static int nv_row_to_rgba_simd(const struct yuv_coeffs *, const uint8_t *, const uint8_t *,
+                               bool, uint8_t *, int)
+{
+    return 0;
+}
+#endif
+
+int gralloc_convert_nv_to_rgba(const struct gralloc_yuv_image *src, bool full_range,
+                               uint8_t *rgba, int rgba_stride)
+{
+    const struct yuv_coeffs *k = full_range ? &bt601_full : &bt601_narrow;
+
+    if (!is_nv(src))
+        return -EINVAL;
+
+    bool vu_order = src->cr < src->cb;
+    const uint8_t *uv_plane = vu_order ? src->cr : src->cb;
+
+    for (int row = 0; row < src->height; row++) {
+        const uint8_t *y = src->y + row * src->y_stride;
+        const uint8_t *uv = uv_plane + (row / 2) * src->c_stride;
+        uint8_t *dst = rgba + row * rgba_stride;
+        int x = nv_row_to_rgba_simd(k, y, uv, vu_order, dst, src->width);
+
+        for (; x < src->width; x++) {
+            int c0 = uv[x & ~1], c1 = uv[(x & ~1) + 1];
+
+            yuv_to_rgba(k, y[x], vu_order ? c1 : c0, vu_order ? c0 : c1, dst + x * 4);
+        }
+    }
+
+    return 0;
+}
+
+#if defined(CONVERT_SSE2)
+/* [a0+a1, a2+a3, b0+b1, b2+b3] */
+static inline __m128i add_pairs_epi32(__m128i a, __m128i b)
+{
+    a = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0));
+    b = _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0));
+    return _mm_add_epi32(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b));
+}
+#endif
+
+static void rgba_row_to_y(const uint8_t *p, uint8_t *y, int n)
+{
+    int x = 0;
+
+#if defined(CONVERT_NEON)
+    for (; x + 16 <= n; x += 16) {
+        uint8x16x4_t px = vld4q_u8(p + x * 4);
+        uint8x8_t y8[2];
+
+        for (int i = 0; i < 2; i++) {
+            uint16x8_t s = vmull_u8(i ? vget_high_u8(px.val[0]) : vget_low_u8(px.val[0]), vdup_n_u8(66));
+            s = vmlal_u8(s, i ? vget_high_u8(px.val[1]) : vget_low_u8(px.val[1]), vdup_n_u8(129));
+            s = vmlal_u8(s, i ? vget_high_u8(px.val[2]) : vget_low_u8(px.val[2]), vdup_n_u8(25));
+            y8[i] = vadd_u8(vrshrn_n_u16(s, 8), vdup_n_u8(16));
+        }
+        vst1q_u8(y + x, vcombine_u8(y8[0], y8[1]));
+    }
+#elif defined(CONVERT_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i k = _mm_setr_epi16(66, 129, 25, 0, 66, 129, 25, 0);
+    const __m128i c128 = _mm_set1_epi32(128);
+    const __m128i c16 = _mm_set1_epi32(16);
+
+    for (; x + 8 <= n; x += 8) {
+        __m128i s[2];
+
+        for (int i = 0; i < 2; i++) {
+            __m128i px = _mm_loadu_si128((const __m128i *)(p + x * 4 + i * 16));
+            __m128i sum = add_pairs_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(px, zero), k),
+                                          _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), k));
+            s[i] = _mm_add_epi32(_mm_srli_epi32(_mm_add_epi32(sum, c128), 8), c16);
+        }
+        __m128i y16 = _mm_packs_epi32(s[0], s[1]);
+        _mm_storel_epi64((__m128i *)(y + x), _mm_packus_epi16(y16, y16));
+    }
+#endif
+    for (; x < n; x++)
+        y[x] = ((66 * p[x * 4] + 129 * p[x * 4 + 1] + 25 * p[x * 4 + 2] + 128) >> 8) + 16;
+}
+
+/* chroma from the average of each 2x2 block of rows p0 and p1, edges clamped */
+static void rgba_rows_to_uv(const uint8_t *p0, const uint8_t *p1, uint8_t *cb, uint8_t *cr, int w)
+{
+    int x = 0;
+
+#if defined(CONVERT_NEON)
+    bool vu_order = cr < cb;
+    uint8_t *uv = vu_order ? cr : cb;
+
+    for (; x + 16 <= w; x += 16) {
+        uint8x16x4_t a = vld4q_u8(p0 + x * 4);
+        uint8x16x4_t b = vld4q_u8(p1 + x * 4);
+        int16x8_t c[3];
+
+        for (int i = 0; i < 3; i++)
+            c[i] = vreinterpretq_s16_u16(vrshrq_n_u16(vaddq_u16(vpaddlq_u8(a.val[i]),
+                                                                vpaddlq_u8(b.val[i])), 2));
+
+        int16x8_t u = vmlaq_n_s16(vmlaq_n_s16(vmulq_n_s16(c[0], -38), c[1], -74), c[2], 112);
+        int16x8_t v = vmlaq_n_s16(vmlaq_n_s16(vmulq_n_s16(c[0], 112), c[1], -94), c[2], -18);
+        u = vaddq_s16(vshrq_n_s16(vaddq_s16(u, vdupq_n_s16(128)), 8), vdupq_n_s16(128));
+        v = vaddq_s16(vshrq_n_s16(vaddq_s16(v, vdupq_n_s16(128)), 8), vdupq_n_s16(128));
+
+        uint8x8x2_t out;
+        out.val[vu_order ? 1 : 0] = vqmovun_s16(u);
+        out.val[vu_order ? 0 : 1] = vqmovun_s16(v);
+        vst2_u8(uv + x, out);
+    }
+#elif defined(CONVERT_SSE2)
+    bool vu_order = cr < cb;
+    uint8_t *uv = vu_order ? cr : cb;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ku = _mm_setr_epi16(-38, -74, 112, 0, -38, -74, 112, 0);
+    const __m128i kv = _mm_setr_epi16(112, -94, -18, 0, 112, -94, -18, 0);
+    const __m128i c2 = _mm_set1_epi16(2);
+    const __m128i c128 = _mm_set1_epi32(128);
+
+    for (; x + 8 <= w; x += 8) {
+        __m128i c[2];
+
+        /* c[i]: R, G, B, A averages of blocks 2i and 2i + 1 */
+        for (int i = 0; i < 2; i++) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(p0 + x * 4 + i * 16));
+            __m128i b = _mm_loadu_si128((const __m128i *)(p1 + x * 4 + i * 16));
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+            lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+            hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+            c[i] = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), c2), 2);
+        }
+
+        __m128i u = add_pairs_epi32(_mm_madd_epi16(c[0], ku), _mm_madd_epi16(c[1], ku));
+        __m128i v = add_pairs_epi32(_mm_madd_epi16(c[0], kv), _mm_madd_epi16(c[1], kv));
+        u = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(u, c128), 8), c128);
+        v = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(v, c128), 8), c128);
+
+        __m128i uv8 = _mm_packus_epi16(_mm_packs_epi32(u, v), zero);
+        __m128i out = vu_order ? _mm_unpacklo_epi8(_mm_srli_si128(uv8, 4), uv8)
+                               : _mm_unpacklo_epi8(uv8, _mm_srli_si128(uv8, 4));
+        _mm_storel_epi64((__m128i *)(uv + x), out);
+    }
+#endif
+    for (; x < w; x += 2) {
+        int x1 = (x + 1 < w) ? x + 1 : x;
+        int r = (p0[x * 4] + p0[x1 * 4] + p1[x * 4] + p1[x1 * 4] + 2) >> 2;
+        int g = (p0[x * 4 + 1] + p0[x1 * 4 + 1] + p1[x * 4 + 1] + p1[x1 * 4 + 1] + 2) >> 2;
+        int b = (p0[x * 4 + 2] + p0[x1 * 4 + 2] + p1[x * 4 + 2] + p1[x1 * 4 + 2] + 2) >> 2;
+
+        cb[x] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        cr[x] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+}
+
+int gralloc_convert_rgba_to_nv(const uint8_t *rgba, int rgba_stride,
+                               const struct gralloc_yuv_image *dst)
+{
+    if (!is_nv(dst))
+        return -EINVAL;
+
+    for (int row = 0; row < dst->height; row++)
+        rgba_row_to_y(rgba + row * rgba_stride, dst->y + row * dst->y_stride, dst->width);
+
+    for (int row = 0; row < dst->height; row += 2) {
+        const uint8_t *p0 = rgba + row * rgba_stride;
+        const uint8_t *p1 = (row + 1 < dst->height) ? p0 + rgba_stride : p0;
+
+        rgba_rows_to_uv(p0, p1, dst->cb + (row / 2) * dst->c_stride,
+                        dst->cr + (row / 2) * dst->c_stride, dst->width);
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+
+static void interleave_row(const uint8_t *a, const uint8_t *b, uint8_t *dst, int n)
+{
+    int i = 0;
+
+#if defined(CONVERT_NEON)
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x2_t ab = { { vld1q_u8(a + i), vld1q_u8(b + i) } };
+        vst2q_u8(dst + i * 2, ab);
+    }
+#elif defined(CONVERT_SSE2)
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)(dst + i * 2), _mm_unpacklo_epi8(va, vb));
+        _mm_storeu_si128((__m128i *)(dst + i * 2 + 16), _mm_unpackhi_epi8(va, vb));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i * 2] = a[i];
+        dst[i * 2 + 1] = b[i];
+    }
+}
+
+static void deinterleave_row(const uint8_t *src, uint8_t *a, uint8_t *b, int n)
+{
+    int i = 0;
+
+#if defined(CONVERT_NEON)
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x2_t ab = vld2q_u8(src + i * 2);
+        vst1q_u8(a + i, ab.val[0]);
+        vst1q_u8(b + i, ab.val[1]);
+    }
+#elif defined(CONVERT_SSE2)
+    const __m128i lo8 = _mm_set1_epi16(0xff);
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i s0 = _mm_loadu_si128((const __m128i *)(src + i * 2));
+        __m128i s1 = _mm_loadu_si128((const __m128i *)(src + i * 2 + 16));
+        _mm_storeu_si128((__m128i *)(a + i), _mm_packus_epi16(_mm_and_si128(s0, lo8),
+                                                              _mm_and_si128(s1, lo8)));
+        _mm_storeu_si128((__m128i *)(b + i), _mm_packus_epi16(_mm_srli_epi16(s0, 8),
+                                                              _mm_srli_epi16(s1, 8)));
+    }
+#endif
+    for (; i < n; i++) {
+        a[i] = src[i * 2];
+        b[i] = src[i * 2 + 1];
+    }
+}
+
+static void copy_luma(const struct gralloc_yuv_image *src, const struct gralloc_yuv_image *dst,
+                      int bytes_per_row)
+{
+    for (int row = 0; row < src->height; row++)
+        memcpy(dst->y + row * dst->y_stride, src->y + row * src->y_stride, bytes_per_row);
+}
+
+int gralloc_convert_planar_to_nv(const struct gralloc_yuv_image *src,
+                                 const struct gralloc_yuv_image *dst)
+{
+    if (!is_planar(src) || !is_nv(dst) ||
+        (src->width != dst->width) || (src->height != dst->height))
+        return -EINVAL;
+
+    bool vu_order = dst->cr < dst->cb;
+    uint8_t *uv_plane = vu_order ? dst->cr : dst->cb;
+    int cw = (src->width + 1) / 2;
+
+    copy_luma(src, dst, src->width);
+    for (int row = 0; row < (src->height + 1) / 2; row++) {
+        const uint8_t *cb = src->cb + row * src->c_stride;
+        const uint8_t *cr = src->cr + row * src->c_stride;
+
+        interleave_row(vu_order ? cr : cb, vu_order ? cb : cr,
+                       uv_plane + row * dst->c_stride, cw);
+    }
+
+    return 0;
+}
+
+int gralloc_convert_nv_to_planar(const struct gralloc_yuv_image *src,
+                                 const struct gralloc_yuv_image *dst)
+{
+    if (!is_nv(src) || !is_planar(dst) ||
+        (src->width != dst->width) || (src->height != dst->height))
+        return -EINVAL;
+
+    bool vu_order = src->cr < src->cb;
+    const uint8_t *uv_plane = vu_order ? src->cr : src->cb;
+    int cw = (src->width + 1) / 2;
+
+    copy_luma(src, dst, src->width);
+    for (int row = 0; row < (src->height + 1) / 2; row++) {
+        uint8_t *cb = dst->cb + row * dst->c_stride;
+        uint8_t *cr = dst->cr + row * dst->c_stride;
+
+        deinterleave_row(uv_plane + row * src->c_stride, vu_order ? cr : cb,
+                         vu_order ? cb : cr, cw);
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+
+/* n samples of 8-bit MSBs plus packed 2-bit LSBs to P010 */
+static void s10b_row_to_p010(const uint8_t *msb, const uint8_t *lsb, uint16_t *dst, int n)
+{
+    int i = 0;
+
+#if defined(CONVERT_NEON)
+    static const uint8_t spread[16] = { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 };
+    static const int8_t shifts[16] = { 0, -2, -4, -6, 0, -2, -4, -6, 0, -2, -4, -6, 0, -2, -4, -6 };
+    const uint8x8_t spread_lo = vld1_u8(spread);
+    const uint8x8_t spread_hi = vld1_u8(spread + 8);
+    const int8x16_t shift = vld1q_s8(shifts);
+
+    for (; i + 16 <= n; i += 16) {
+        uint32_t packed;
+        memcpy(&packed, lsb + i / 4, 4);
+        uint8x8_t p = vreinterpret_u8_u32(vdup_n_u32(packed));
+        uint8x16_t bits = vcombine_u8(vtbl1_u8(p, spread_lo), vtbl1_u8(p, spread_hi));
+        bits = vandq_u8(vshlq_u8(bits, shift), vdupq_n_u8(3));
+        uint8x16_t m = vld1q_u8(msb + i);
+
+        vst1q_u16(dst + i, vshlq_n_u16(vorrq_u16(vshll_n_u8(vget_low_u8(m), 2),
+                                                 vmovl_u8(vget_low_u8(bits))), 6));
+        vst1q_u16(dst + i + 8, vshlq_n_u16(vorrq_u16(vshll_n_u8(vget_high_u8(m), 2),
+                                                     vmovl_u8(vget_high_u8(bits))), 6));
+    }
+#elif defined(CONVERT_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask0 = _mm_set1_epi32(0x00000003);
+    const __m128i mask1 = _mm_set1_epi32(0x00000300);
+    const __m128i mask2 = _mm_set1_epi32(0x00030000);
+    const __m128i mask3 = _mm_set1_epi32(0x03000000);
+
+    for (; i + 16 <= n; i += 16) {
+        int32_t packed;
+        memcpy(&packed, lsb + i / 4, 4);
+        __m128i p = _mm_cvtsi32_si128(packed);
+        /* every byte four times, then pick bits 2k+1:2k for the k-th copy */
+        p = _mm_unpacklo_epi8(p, p);
+        p = _mm_unpacklo_epi16(p, p);
+        __m128i bits = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(p, mask0), _mm_and_si128(_mm_srli_epi16(p, 2), mask1)),
+            _mm_or_si128(_mm_and_si128(_mm_srli_epi16(p, 4), mask2),
+                         _mm_and_si128(_mm_srli_epi16(p, 6), mask3)));
+        __m128i m = _mm_loadu_si128((const __m128i *)(msb + i));
+
+        __m128i lo = _mm_or_si128(_mm_slli_epi16(_mm_unpacklo_epi8(m, zero), 2),
+                                  _mm_unpacklo_epi8(bits, zero));
+        __m128i hi = _mm_or_si128(_mm_slli_epi16(_mm_unpackhi_epi8(m, zero), 2),
+                                  _mm_unpackhi_epi8(bits, zero));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_slli_epi16(lo, 6));
+        _mm_storeu_si128((__m128i *)(dst + i + 8), _mm_slli_epi16(hi, 6));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = ((msb[i] << 2) | ((lsb[i / 4] >> ((i % 4) * 2)) & 3)) << 6;
+}
+
+int gralloc_convert_s10b_to_p010(const struct gralloc_yuv_image *src,
+                                 const struct gralloc_yuv_image *dst)
+{
+    if (!is_nv(src) || !src->y2b || !src->c2b || !is_p010(dst) ||
+        (src->width != dst->width) || (src->height != dst->height))
+        return -EINVAL;
+
+    const uint8_t *src_uv = (src->cr < src->cb) ? src->cr : src->cb;
+    uint8_t *dst_uv = (dst->cr < dst->cb) ? dst->cr : dst->cb;
+    int cw = ((src->width + 1) / 2) * 2;
+
+    for (int row = 0; row < src->height; row++)
+        s10b_row_to_p010(src->y + row * src->y_stride, src->y2b + row * src->y2b_stride,
+                         (uint16_t *)(dst->y + row * dst->y_stride), src->width);
+
+    for (int row = 0; row < (src->height + 1) / 2; row++)
+        s10b_row_to_p010(src_uv + row * src->c_stride, src->c2b + row * src->c2b_stride,
+                         (uint16_t *)(dst_uv + row * dst->c_stride), cw);
+
+    return 0;
+}
+
+/*****************************************************************************/
+
+/* BT.2020 narrow range, 10-bit, in 14-bit fixed point */
+#define P010_Y_MUL      19133
+#define P010_RV         27584
+#define P010_GU         3078
+#define P010_GV         10688
+#define P010_BU         35194
+
+static void p010_row_to_rgba1010102(const uint16_t *y, const uint16_t *uv, bool vu_order,
+                                   uint32_t *dst, int w)
+{
+    int x = 0;
+
+#if defined(CONVERT_NEON)
+    for (; x + 8 <= w; x += 8) {
+        int16x8_t ys = vsubq_s16(vreinterpretq_s16_u16(vshrq_n_u16(vld1q_u16(y + x), 6)),
+                                 vdupq_n_s16(64));
+        uint16x4x2_t c = vld2_u16(uv + x);
+        int16x4_t u4 = vsub_s16(vreinterpret_s16_u16(vshr_n_u16(c.val[vu_order ? 1 : 0], 6)),
+                                vdup_n_s16(512));
+        int16x4_t v4 = vsub_s16(vreinterpret_s16_u16(vshr_n_u16(c.val[vu_order ? 0 : 1], 6)),
+                                vdup_n_s16(512));
+        /* each chroma sample for the two pixels sharing it */
+        int16x4x2_t u = vzip_s16(u4, u4);
+        int16x4x2_t v = vzip_s16(v4, v4);
+
+        for (int i = 0; i < 2; i++) {
+            int32x4_t yy = vaddq_s32(vmull_n_s16(i ? vget_high_s16(ys) : vget_low_s16(ys), P010_Y_MUL),
+                                     vdupq_n_s32(8192));
+            int32x4_t r = vaddq_s32(yy, vmull_n_s16(v.val[i], P010_RV));
+            int32x4_t g = vsubq_s32(vsubq_s32(yy, vmull_n_s16(u.val[i], P010_GU)),
+                                    vmull_n_s16(v.val[i], P010_GV));
+            int32x4_t b = vaddq_s32(yy, vmulq_n_s32(vmovl_s16(u.val[i]), P010_BU));
+            uint32x4_t out = vdupq_n_u32(3u << 30);
+
+            r = vmaxq_s32(vminq_s32(vshrq_n_s32(r, 14), vdupq_n_s32(1023)), vdupq_n_s32(0));
+            g = vmaxq_s32(vminq_s32(vshrq_n_s32(g, 14), vdupq_n_s32(1023)), vdupq_n_s32(0));
+            b = vmaxq_s32(vminq_s32(vshrq_n_s32(b, 14), vdupq_n_s32(1023)), vdupq_n_s32(0));
+            out = vorrq_u32(out, vreinterpretq_u32_s32(r));
+            out = vorrq_u32(out, vshlq_n_u32(vreinterpretq_u32_s32(g), 10));
+            out = vorrq_u32(out, vshlq_n_u32(vreinterpretq_u32_s32(b), 20));
+            vst1q_u32(dst + x + i * 4, out);
+        }
+    }
+#elif defined(CONVERT_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c64 = _mm_set1_epi16(64);
+    const __m128i c512 = _mm_set1_epi16(512);
+    const __m128i c1023 = _mm_set1_epi16(1023);
+    const __m128i c8192 = _mm_set1_epi32(8192);
+    const __m128i alpha = _mm_set1_epi32(3u << 30);
+    const __m128i ky = _mm_setr_epi16(P010_Y_MUL, 0, P010_Y_MUL, 0, P010_Y_MUL, 0, P010_Y_MUL, 0);
+    const __m128i kr = _mm_setr_epi16(0, P010_RV, 0, P010_RV, 0, P010_RV, 0, P010_RV);
+    const __m128i kg = _mm_setr_epi16(-P010_GU, -P010_GV, -P010_GU, -P010_GV,
+                                      -P010_GU, -P010_GV, -P010_GU, -P010_GV);
+    /* P010_BU doesn't fit a 16-bit lane, multiply by half of it and double */
+    const __m128i kb = _mm_setr_epi16(P010_BU / 2, 0, P010_BU / 2, 0, P010_BU / 2, 0, P010_BU / 2, 0);
+
+    for (; x + 8 <= w; x += 8) {
+        __m128i ys = _mm_sub_epi16(_mm_srli_epi16(_mm_loadu_si128((const __m128i *)(y + x)), 6), c64);
+        __m128i c = _mm_sub_epi16(_mm_srli_epi16(_mm_loadu_si128((const __m128i *)(uv + x)), 6), c512);
+        __m128i r[2], g[2], b[2];
+
+        /* u, v pairs, each repeated for the two pixels sharing it */
+        if (vu_order)
+            c = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+
+        for (int i = 0; i < 2; i++) {
+            __m128i cc = i ? _mm_unpackhi_epi32(c, c) : _mm_unpacklo_epi32(c, c);
+            __m128i yy = _mm_madd_epi16(i ? _mm_unpackhi_epi16(ys, zero) : _mm_unpacklo_epi16(ys, zero), ky);
+
+            yy = _mm_add_epi32(yy, c8192);
+            r[i] = _mm_srai_epi32(_mm_add_epi32(yy, _mm_madd_epi16(cc, kr)), 14);
+            g[i] = _mm_srai_epi32(_mm_add_epi32(yy, _mm_madd_epi16(cc, kg)), 14);
+            b[i] = _mm_srai_epi32(_mm_add_epi32(yy, _mm_slli_epi32(_mm_madd_epi16(cc, kb), 1)), 14);
+        }
+
+        __m128i r16 = _mm_max_epi16(_mm_min_epi16(_mm_packs_epi32(r[0], r[1]), c1023), zero);
+        __m128i g16 = _mm_max_epi16(_mm_min_epi16(_mm_packs_epi32(g[0], g[1]), c1023), zero);
+        __m128i b16 = _mm_max_epi16(_mm_min_epi16(_mm_packs_epi32(b[0], b[1]), c1023), zero);
+
+        for (int i = 0; i < 2; i++) {
+            __m128i out = i ? _mm_unpackhi_epi16(r16, zero) : _mm_unpacklo_epi16(r16, zero);
+            out = _mm_or_si128(out, _mm_slli_epi32(i ? _mm_unpackhi_epi16(g16, zero)
+                                                     : _mm_unpacklo_epi16(g16, zero), 10));
+            out = _mm_or_si128(out, _mm_slli_epi32(i ? _mm_unpackhi_epi16(b16, zero)
+                                                     : _mm_unpacklo_epi16(b16, zero), 20));
+            _mm_storeu_si128((__m128i *)(dst + x + i * 4), _mm_or_si128(out, alpha));
+        }
+    }
+#endif
+    for (; x < w; x++) {
+        int c0 = (uv[x & ~1] >> 6) - 512, c1 = (uv[(x & ~1) + 1] >> 6) - 512;
+        int u = vu_order ? c1 : c0, v = vu_order ? c0 : c1;
+        int yy = ((y[x] >> 6) - 64) * P010_Y_MUL + 8192;
+        int r = clamp10((yy + P010_RV * v) >> 14);
+        int g = clamp10((yy - P010_GU * u - P010_GV * v) >> 14);
+        int b = clamp10((yy + P010_BU * u) >> 14);
+
+        dst[x] = r | (g << 10) | (b << 20) | (3u << 30);
+    }
+}
+
+int gralloc_convert_p010_to_rgba1010102(const struct gralloc_yuv_image *src,
+                                        uint8_t *rgba, int rgba_stride)
+{
+    if (!is_p010(src))
+        return -EINVAL;
+
+    bool vu_order = src->cr < src->cb;
+    const uint8_t *uv_plane = vu_order ? src->cr : src->cb;
+
+    for (int row = 0; row < src->height; row++)
+        p010_row_to_rgba1010102((const uint16_t *)(src->y + row * src->y_stride),
+                                (const uint16_t *)(uv_plane + (row / 2) * src->c_stride),
+                                vu_order, (uint32_t *)(rgba + row * rgba_stride), src->width);
+
+    return 0;
+}
+
+static void rgba1010102_row_to_y(const uint32_t *p, uint16_t *y, int n)
+{
+    int x = 0;
+
+#if defined(CONVERT_NEON)
+    const uint32x4_t mask = vdupq_n_u32(0x3ff);
+
+    for (; x + 8 <= n; x += 8) {
+        uint16x4_t y4[2];
+
+        for (int i = 0; i < 2; i++) {
+            uint32x4_t px = vld1q_u32(p + x + i * 4);
+            uint32x4_t s = vmulq_n_u32(vandq_u32(px, mask), 3686);
+
+            s = vmlaq_n_u32(s, vandq_u32(vshrq_n_u32(px, 10), mask), 9512);
+            s = vmlaq_n_u32(s, vandq_u32(vshrq_n_u32(px, 20), mask), 832);
+            s = vaddq_u32(vshrq_n_u32(vaddq_u32(s, vdupq_n_u32(8192)), 14), vdupq_n_u32(64));
+            y4[i] = vmovn_u32(vshlq_n_u32(s, 6));
+        }
+        vst1q_u16(y + x, vcombine_u16(y4[0], y4[1]));
+    }
+#elif defined(CONVERT_SSE2)
+    const __m128i mask = _mm_set1_epi32(0x3ff);
+    const __m128i g_mask = _mm_set1_epi32(0x3ff << 16);
+    const __m128i krg = _mm_setr_epi16(3686, 9512, 3686, 9512, 3686, 9512, 3686, 9512);
+    const __m128i kb = _mm_setr_epi16(832, 0, 832, 0, 832, 0, 832, 0);
+    const __m128i c8192 = _mm_set1_epi32(8192);
+    const __m128i c64 = _mm_set1_epi32(64);
+
+    for (; x + 8 <= n; x += 8) {
+        __m128i s[2];
+
+        for (int i = 0; i < 2; i++) {
+            __m128i px = _mm_loadu_si128((const __m128i *)(p + x + i * 4));
+            /* r in the low and g in the high half of each lane */
+            __m128i rg = _mm_or_si128(_mm_and_si128(px, mask), _mm_and_si128(_mm_slli_epi32(px, 6), g_mask));
+            __m128i sum = _mm_add_epi32(_mm_madd_epi16(rg, krg),
+                                        _mm_madd_epi16(_mm_and_si128(_mm_srli_epi32(px, 20), mask), kb));
+            s[i] = _mm_add_epi32(_mm_srli_epi32(_mm_add_epi32(sum, c8192), 14), c64);
+        }
+        _mm_storeu_si128((__m128i *)(y + x), _mm_slli_epi16(_mm_packs_epi32(s[0], s[1]), 6));
+    }
+#endif
+    for (; x < n; x++) {
+        int r = p[x] & 0x3ff, g = (p[x] >> 10) & 0x3ff, b = (p[x] >> 20) & 0x3ff;
+
+        y[x] = (((3686 * r + 9512 * g + 832 * b + 8192) >> 14) + 64) << 6;
+    }
+}
+
+static void rgba1010102_rows_to_uv(const uint32_t *p0, const uint32_t *p1,
+                                   uint16_t *cb, uint16_t *cr, int w)
+{
+    int x = 0;
+
+#if defined(CONVERT_NEON)
+    bool vu_order = cr < cb;
+    uint16_t *uv = vu_order ? cr : cb;
+    const uint32x4_t mask = vdupq_n_u32(0x3ff);
+
+    for (; x + 8 <= w; x += 8) {
+        /* even and odd pixels of both rows */
+        uint32x4x2_t a = vld2q_u32(p0 + x);
+        uint32x4x2_t b = vld2q_u32(p1 + x);
+        int32x4_t c[3];
+
+        for (int i = 0; i < 3; i++) {
+            const int32x4_t shift = vdupq_n_s32(-i * 10);
+            uint32x4_t sum = vaddq_u32(vandq_u32(vshlq_u32(a.val[0], shift), mask),
+                                       vandq_u32(vshlq_u32(a.val[1], shift), mask));
+            sum = vaddq_u32(sum, vandq_u32(vshlq_u32(b.val[0], shift), mask));
+            sum = vaddq_u32(sum, vandq_u32(vshlq_u32(b.val[1], shift), mask));
+            c[i] = vreinterpretq_s32_u32(vshrq_n_u32(vaddq_u32(sum, vdupq_n_u32(2)), 2));
+        }
+
+        int32x4_t u = vmlaq_n_s32(vmlaq_n_s32(vmulq_n_s32(c[0], -2004), c[1], -5171), c[2], 7175);
+        int32x4_t v = vmlaq_n_s32(vmlaq_n_s32(vmulq_n_s32(c[0], 7175), c[1], -6598), c[2], -577);
+        u = vaddq_s32(vshrq_n_s32(vaddq_s32(u, vdupq_n_s32(8192)), 14), vdupq_n_s32(512));
+        v = vaddq_s32(vshrq_n_s32(vaddq_s32(v, vdupq_n_s32(8192)), 14), vdupq_n_s32(512));
+
+        uint16x4x2_t out;
+        out.val[vu_order ? 1 : 0] = vmovn_u32(vshlq_n_u32(vreinterpretq_u32_s32(u), 6));
+        out.val[vu_order ? 0 : 1] = vmovn_u32(vshlq_n_u32(vreinterpretq_u32_s32(v), 6));
+        vst2_u16(uv + x, out);
+    }
+#elif defined(CONVERT_SSE2)
+    bool vu_order = cr < cb;
+    uint16_t *uv = vu_order ? cr : cb;
+    const __m128i mask = _mm_set1_epi32(0x3ff);
+    const __m128i ku_rg = _mm_setr_epi16(-2004, -5171, -2004, -5171, -2004, -5171, -2004, -5171);
+    const __m128i ku_b = _mm_setr_epi16(7175, 0, 7175, 0, 7175, 0, 7175, 0);
+    const __m128i kv_rg = _mm_setr_epi16(7175, -6598, 7175, -6598, 7175, -6598, 7175, -6598);
+    const __m128i kv_b = _mm_setr_epi16(-577, 0, -577, 0, -577, 0, -577, 0);
+    const __m128i c2 = _mm_set1_epi32(2);
+    const __m128i c512 = _mm_set1_epi32(512);
+    const __m128i c8192 = _mm_set1_epi32(8192);
+
+    for (; x + 8 <= w; x += 8) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(p0 + x));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(p0 + x + 4));
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(p1 + x));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(p1 + x + 4));
+        __m128i c[3];
+
+        for (int i = 0; i < 3; i++) {
+            const __m128i shift = _mm_cvtsi32_si128(i * 10);
+            __m128i s0 = _mm_add_epi32(_mm_and_si128(_mm_srl_epi32(a0, shift), mask),
+                                       _mm_and_si128(_mm_srl_epi32(b0, shift), mask));
+            __m128i s1 = _mm_add_epi32(_mm_and_si128(_mm_srl_epi32(a1, shift), mask),
+                                       _mm_and_si128(_mm_srl_epi32(b1, shift), mask));
+            c[i] = _mm_srli_epi32(_mm_add_epi32(add_pairs_epi32(s0, s1), c2), 2);
+        }
+
+        /* r in the low and g in the high half of each lane */
+        __m128i rg = _mm_or_si128(c[0], _mm_slli_epi32(c[1], 16));
+        __m128i u = _mm_add_epi32(_mm_madd_epi16(rg, ku_rg), _mm_madd_epi16(c[2], ku_b));
+        __m128i v = _mm_add_epi32(_mm_madd_epi16(rg, kv_rg), _mm_madd_epi16(c[2], kv_b));
+        u = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(u, c8192), 14), c512);
+        v = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(v, c8192), 14), c512);
+        u = _mm_packs_epi32(u, u);
+        v = _mm_packs_epi32(v, v);
+
+        __m128i out = vu_order ? _mm_unpacklo_epi16(v, u) : _mm_unpacklo_epi16(u, v);
+        _mm_storeu_si128((__m128i *)(uv + x), _mm_slli_epi16(out, 6));
+    }
+#endif
+    for (; x < w; x += 2) {
+        int x1 = (x + 1 < w) ? x + 1 : x;
+        uint32_t q[4] = { p0[x], p0[x1], p1[x], p1[x1] };
+        int r = 0, g = 0, b = 0;
+
+        for (int i = 0; i < 4; i++) {
+            r += q[i] & 0x3ff;
+            g += (q[i] >> 10) & 0x3ff;
+            b += (q[i] >> 20) & 0x3ff;
+        }
+        r = (r + 2) >> 2;
+        g = (g + 2) >> 2;
+        b = (b + 2) >> 2;
+
+        cb[x] = (((-2004 * r - 5171 * g + 7175 * b + 8192) >> 14) + 512) << 6;
+        cr[x] = (((7175 * r - 6598 * g - 577 * b + 8192) >> 14) + 512) << 6;
+    }
+}
+
+int gralloc_convert_rgba1010102_to_p010(const uint8_t *rgba, int rgba_stride,
+                                        const struct gralloc_yuv_image *dst)
+{
+    if (!is_p010(dst))
+        return -EINVAL;
+
+    for (int row = 0; row < dst->height; row++)
+        rgba1010102_row_to_y((const uint32_t *)(rgba + row * rgba_stride),
+                             (uint16_t *)(dst->y + row * dst->y_stride), dst->width);
+
+    for (int row = 0; row < dst->height; row += 2) {
+        const uint32_t *p0 = (const uint32_t *)(rgba + row * rgba_stride);
+        const uint32_t *p1 = (row + 1 < dst->height) ? (const uint32_t *)((const uint8_t *)p0 + rgba_stride) : p0;
+
+        rgba1010102_rows_to_uv(p0, p1, (uint16_t *)(dst->cb + (row / 2) * dst->c_stride),
+                               (uint16_t *)(dst->cr + (row / 2) * dst->c_stride), dst->width);
+    }
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GRALLOC_FORMAT_CONVERT_H_
+#define GRALLOC_FORMAT_CONVERT_H_
+
+#include <stdint.h>
+
+#include "gralloc_priv.h"
+
+/*
+ * CPU conversions between the 4:2:0 layouts gralloc allocates and RGBA,
+ * for screenshots, thumbnails and fallback composition. All strides are
+ * in bytes. Every conversion has NEON and SSE2 versions of its row loop,
+ * with plain C for the tail of each row and for other CPUs. Both give the
+ * same output bit for bit; test/format_convert_test.cpp checks that.
+ */
+
+/*
+ * One 4:2:0 image. cb/cr point at the first sample of each chroma plane:
+ * c_step is 2 for NV12/NV21 (cb and cr one byte apart in the same plane),
+ * 1 for planar layouts and 4 for P010. y2b/c2b are the packed 2-bit LSB
+ * planes of S10B formats (four samples per byte, first sample in the low
+ * bits), NULL otherwise.
+ */
+struct gralloc_yuv_image {
+    int width;
+    int height;
+    uint8_t *y;
+    int y_stride;
+    uint8_t *cb;
+    uint8_t *cr;
+    int c_stride;
+    int c_step;
+    uint8_t *y2b;
+    int y2b_stride;
+    uint8_t *c2b;
+    int c2b_stride;
+};
+
+/* describes a buffer mapped by gralloc_lock/gralloc_lock_ycbcr */
+int gralloc_yuv_image_from_handle(const private_handle_t *hnd, struct gralloc_yuv_image *img);
+
+/* BT.601, narrow or full range; RGBA is R, G, B, A in memory */
+int gralloc_convert_nv_to_rgba(const struct gralloc_yuv_image *src, bool full_range,
+                               uint8_t *rgba, int rgba_stride);
+int gralloc_convert_rgba_to_nv(const uint8_t *rgba, int rgba_stride,
+                               const struct gralloc_yuv_image *dst);
+
+/* planar (YV12 and friends) <-> semi-planar (NV21/NV12) */
+int gralloc_convert_planar_to_nv(const struct gralloc_yuv_image *src,
+                                 const struct gralloc_yuv_image *dst);
+int gralloc_convert_nv_to_planar(const struct gralloc_yuv_image *src,
+                                 const struct gralloc_yuv_image *dst);
+
+/* 8+2 bit S10B to 16-bit P010, 10 bits in the high bits of each sample */
+int gralloc_convert_s10b_to_p010(const struct gralloc_yuv_image *src,
+                                 const struct gralloc_yuv_image *dst);
+
+/* BT.2020 narrow range; RGBA_1010102 is R in the low bits of each word */
+int gralloc_convert_p010_to_rgba1010102(const struct gralloc_yuv_image *src,
+                                        uint8_t *rgba, int rgba_stride);
+int gralloc_convert_rgba1010102_to_p010(const uint8_t *rgba, int rgba_stride,
+                                        const struct gralloc_yuv_image *dst);
+
+#endif /* GRALLOC_FORMAT_CONVERT_H_ */
@@ -15,6 +15,7 @@
  */
 
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <dlfcn.h>
 
@@ -62,6 +63,12 @@ typedef android::Vector<struct hwc_callback_entry> hwc_callback_queue_t;
 
 struct fb_context_t {
     framebuffer_device_t  device;
+    /* area set by setUpdateRect for the next blit, whole screen if !has_update_rect */
+    bool has_update_rect;
+    int update_l;
+    int update_t;
+    int update_w;
+    int update_h;
 };
 
 /*****************************************************************************/
@@ -77,6 +84,148 @@ static int fb_setSwapInterval(struct framebuffer_device_t* dev,
 }
 #endif
 
+#if !HWC_EXIST
+static int fb_setUpdateRect(struct framebuffer_device_t* dev,
+                            int l, int t, int w, int h)
+{
+    fb_context_t* ctx = (fb_context_t*)dev;
+
+    if (l < 0 || t < 0 || w <= 0 || h <= 0 ||
+        l + w > (int)dev->width || t + h > (int)dev->height)
+        return -EINVAL;
+
+    ctx->has_update_rect = true;
+    ctx->update_l = l;
+    ctx->update_t = t;
+    ctx->update_w = w;
+    ctx->update_h = h;
+    return 0;
+}
+#endif
+
+/* True if hnd is one of the buffers carved out of the fb0 mapping */
+bool fb_is_framebuffer(private_module_t const* m, private_handle_t const* hnd)
+{
+    struct stat fb_st, st;
+
+    if (!m->framebuffer || !(hnd->flags & GRALLOC_USAGE_HW_FB))
+        return false;
+    if (fstat(m->framebuffer->fd, &fb_st) || fstat(hnd->fd, &st))
+        return false;
+
+    return (fb_st.st_rdev == st.st_rdev) && (st.st_ino == fb_st.st_ino);
+}
+
+/*
+ * Hands out one of the numBuffers screens of the yres_virtual area mapped
+ * by init_fb, so fb_post can present it by panning. Returns -ENOMEM when
+ * page flipping is unavailable or all screens are in use, the caller then
+ * allocates a normal buffer that fb_post copies instead.
+ *
+ * Only the process that opened fb0 has m->framebuffer, so this applies to
+ * non-Treble builds where SurfaceFlinger loads gralloc itself. Under
+ * Treble, HW_FB buffers are allocated by the allocator service, which
+ * never opens fb0; they always come from ION and fb_post copies them.
+ */
+int fb_alloc_buffer(private_module_t* m, int w, int h, int format, int usage,
+                    private_handle_t** pHnd, int* pStride)
+{
+    if (!(m->flags & private_module_t::PAGE_FLIP) || !m->framebuffer)
+        return -ENOMEM;
+    if (w != m->xres || h != m->yres || format != m->framebuffer->format)
+        return -ENOMEM;
+
+    pthread_mutex_lock(&m->lock);
+
+    uint32_t i;
+    for (i = 0; i < m->numBuffers; i++)
+        if (!(m->bufferMask & (1U << i)))
+            break;
+    if (i == m->numBuffers) {
+        pthread_mutex_unlock(&m->lock);
+        return -ENOMEM;
+    }
+
+    int fd = dup(m->framebuffer->fd);
+    if (fd < 0) {
+        pthread_mutex_unlock(&m->lock);
+        return -errno;
+    }
+
+    size_t bufferSize = m->finfo.line_length * m->info.yres;
+    int stride = m->finfo.line_length / (m->info.bits_per_pixel >> 3);
+    private_handle_t* hnd = new private_handle_t(fd, bufferSize, usage, w, h,
+                                                 format, format, format, stride, h, 0);
+    hnd->offset = i * bufferSize;
+    hnd->base = m->framebuffer->base + hnd->offset;
+    m->bufferMask |= (1U << i);
+
+    pthread_mutex_unlock(&m->lock);
+
+    *pHnd = hnd;
+    *pStride = stride;
+    return 0;
+}
+
+void fb_free_buffer(private_module_t* m, private_handle_t* hnd)
+{
+    size_t bufferSize = m->finfo.line_length * m->info.yres;
+
+    pthread_mutex_lock(&m->lock);
+    m->bufferMask &= ~(1U << (hnd->offset / bufferSize));
+    pthread_mutex_unlock(&m->lock);
+
+    close(hnd->fd);
+    delete hnd;
+}
+
+#if !HWC_EXIST
+/*
+ * Copies the update rect (or the whole screen) of buffer into the fb0
+ * screen being scanned out. With page flipping that is the one at
+ * info.yoffset, not necessarily the first, and copying there also keeps
+ * what is outside the update rect as it was on screen.
+ */
+static int fb_blit(fb_context_t* ctx, private_module_t* m, buffer_handle_t buffer)
+{
+    private_handle_t const* hnd = reinterpret_cast<private_handle_t const*>(buffer);
+    int bpp = m->info.bits_per_pixel >> 3;
+    int l = 0, t = 0, w = m->info.xres, h = m->info.yres;
+    void* buffer_vaddr;
+
+    if (!m->framebuffer)
+        return -ENODEV;
+
+    if (ctx->has_update_rect) {
+        l = ctx->update_l;
+        t = ctx->update_t;
+        w = ctx->update_w;
+        h = ctx->update_h;
+        ctx->has_update_rect = false;
+    }
+
+    if (m->base.lock(&m->base, buffer, GRALLOC_USAGE_SW_READ_RARELY,
+                     l, t, w, h, &buffer_vaddr))
+        return -EINVAL;
+
+    size_t src_stride = hnd->stride * bpp;
+    size_t dst_stride = m->finfo.line_length;
+    uint8_t* src = (uint8_t*)buffer_vaddr + t * src_stride + l * bpp;
+    uint8_t* dst = (uint8_t*)(uintptr_t)m->framebuffer->base +
+                   (m->info.yoffset + t) * dst_stride + l * bpp;
+
+    if (src_stride == dst_stride && w == (int)m->info.xres) {
+        memcpy(dst, src, dst_stride * h);
+    } else {
+        for (int y = 0; y < h; y++, src += src_stride, dst += dst_stride)
+            memcpy(dst, src, w * bpp);
+    }
+
+    m->base.unlock(&m->base, buffer);
+    return 0;
+}
+#endif
+
 static int fb_post(struct framebuffer_device_t* dev, buffer_handle_t buffer)
 {
     if (private_handle_t::validate(buffer) < 0)
@@ -97,25 +246,25 @@ static int fb_post(struct framebuffer_device_t* dev, buffer_handle_t buffer)
         entry.callback(entry.data, hnd);
     }
 #else
-    // If we can't do the page_flip, just copy the buffer to the front
-    // FIXME: use copybit HAL instead of memcpy
-    void* fb_vaddr;
-    void* buffer_vaddr;
-
-    m->base.lock(&m->base, m->framebuffer,
-            GRALLOC_USAGE_SW_WRITE_RARELY,
-            0, 0, m->info.xres, m->info.yres,
-            &fb_vaddr);
-
-    m->base.lock(&m->base, buffer,
-            GRALLOC_USAGE_SW_READ_RARELY,
-            0, 0, m->info.xres, m->info.yres,
-            &buffer_vaddr);
+    private_handle_t const* hnd = reinterpret_cast<private_handle_t const*>(buffer);
 
-    memcpy(fb_vaddr, buffer_vaddr, m->finfo.line_length * m->info.yres);
+    if ((m->flags & private_module_t::PAGE_FLIP) && fb_is_framebuffer(m, hnd)) {
+        m->info.activate = FB_ACTIVATE_VBL;
+        m->info.yoffset = hnd->offset / m->finfo.line_length;
+        if (ioctl(m->framebuffer->fd, FBIOPAN_DISPLAY, &m->info) == -1) {
+            ALOGE("FBIOPAN_DISPLAY failed (%s)", strerror(errno));
+            return -errno;
+        }
+        m->currentBuffer = buffer;
+        return 0;
+    }
 
-    m->base.unlock(&m->base, buffer);
-    m->base.unlock(&m->base, m->framebuffer);
+    // The buffer isn't part of fb0 (or the driver can't pan), copy it to the front
+    // FIXME: use copybit HAL instead of memcpy
+    int err = fb_blit((fb_context_t*)dev, m, buffer);
+    if (err)
+        return err;
+    m->currentBuffer = buffer;
 #endif
     return 0;
 }
@@ -141,19 +290,46 @@ int init_fb(struct private_module_t* module)
         return -errno;
     }
 
-    struct fb_fix_screeninfo finfo;
-    if (ioctl(fd, FBIOGET_FSCREENINFO, &finfo) == -1) {
-        ALOGE("Fail to get FB Screen Info");
+    struct fb_var_screeninfo info;
+    if (ioctl(fd, FBIOGET_VSCREENINFO, &info) == -1) {
+        ALOGE("First, Fail to get FB VScreen Info");
         close(fd);
         return -errno;
     }
 
-    struct fb_var_screeninfo info;
-    if (ioctl(fd, FBIOGET_VSCREENINFO, &info) == -1) {
-        ALOGE("First, Fail to get FB VScreen Info");
+    uint32_t flags = 0;
+#if !HWC_EXIST && !USE_BLIT_FRAMEBUFFER
+    /*
+     * Ask for NUM_BUFFERS screens stacked in yres_virtual so fb_post can
+     * flip between them with FBIOPAN_DISPLAY instead of copying.
+     */
+    info.yres_virtual = info.yres * NUM_BUFFERS;
+    info.yoffset = 0;
+    info.activate = FB_ACTIVATE_NOW;
+    if (ioctl(fd, FBIOPUT_VSCREENINFO, &info) == -1) {
+        ALOGW("FBIOPUT_VSCREENINFO failed, page flipping not supported");
+        if (ioctl(fd, FBIOGET_VSCREENINFO, &info) == -1) {
+            ALOGE("Fail to get FB VScreen Info");
+            close(fd);
+            return -errno;
+        }
+    }
+    if (info.yres_virtual >= info.yres * 2)
+        flags |= private_module_t::PAGE_FLIP;
+    else
+        ALOGW("page flipping not supported (yres_virtual=%d, requested=%d)",
+              info.yres_virtual, info.yres * NUM_BUFFERS);
+#endif
+
+    /* line_length may have changed with the virtual resolution */
+    struct fb_fix_screeninfo finfo;
+    if (ioctl(fd, FBIOGET_FSCREENINFO, &finfo) == -1) {
+        ALOGE("Fail to get FB Screen Info");
         close(fd);
         return -errno;
     }
+    if (!finfo.ypanstep)
+        flags &= ~private_module_t::PAGE_FLIP;
 
     int refreshRate = 1000000000000000LLU /
         (
@@ -180,25 +356,36 @@ int init_fb(struct private_module_t* module)
 
     module->xres = info.xres;
     module->yres = info.yres;
-    module->line_length = info.xres;
+    module->line_length = finfo.line_length;
     module->xdpi = xdpi;
     module->ydpi = ydpi;
     module->fps = fps;
     module->info = info;
     module->finfo = finfo;
 
-#if !HWC_EXIST && USE_BLIT_FRAMEBUFFER
-    size_t fbSize = roundUpToPageSize(finfo.line_length * info.yres_virtual);
-    module->framebuffer = new private_handle_t(dup(fd), fbSize, 0);
-
-    void* vaddr = mmap(0, fbSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
-    if (vaddr == MAP_FAILED) {
-        ALOGE("Error mapping the framebuffer (%s)", strerror(errno));
-        close(fd);
-        return -errno;
+#if !HWC_EXIST
+    if (!module->framebuffer) {
+        size_t fbSize = roundUpToPageSize(finfo.line_length * info.yres_virtual);
+        void* vaddr = mmap(0, fbSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        if (vaddr == MAP_FAILED) {
+            ALOGE("Error mapping the framebuffer (%s)", strerror(errno));
+            close(fd);
+            return -errno;
+        }
+        memset(vaddr, 0, fbSize);
+
+        int format = (info.bits_per_pixel == 16) ? HAL_PIXEL_FORMAT_RGB_565 : HAL_PIXEL_FORMAT_RGBA_8888;
+        int stride = finfo.line_length / (info.bits_per_pixel >> 3);
+        module->framebuffer = new private_handle_t(dup(fd), fbSize, GRALLOC_USAGE_HW_FB,
+                                                   info.xres, info.yres, format, format, format,
+                                                   stride, info.yres_virtual, 0);
+        module->framebuffer->base = (uint64_t)vaddr;
     }
-    module->framebuffer->base = (size_t)vaddr;
-    memset(vaddr, 0, fbSize);
+
+    module->flags = flags;
+    module->numBuffers = (flags & private_module_t::PAGE_FLIP) ? info.yres_virtual / info.yres : 1;
+    ALOGI("%s with %u buffers", (flags & private_module_t::PAGE_FLIP) ? "page flipping" : "blitting",
+          module->numBuffers);
 #endif
 
     close(fd);
@@ -225,24 +412,25 @@ int fb_device_open(hw_module_t const* module, const char* name,
         return status;
     }
 
-    framebuffer_device_t *dev = (framebuffer_device_t *)malloc(sizeof(framebuffer_device_t));
-    if (dev == NULL) {
+    fb_context_t *ctx = (fb_context_t *)malloc(sizeof(fb_context_t));
+    if (ctx == NULL) {
         ALOGE("Failed to allocate memory for dev");
         gralloc_close(gralloc_device);
         return status;
     }
+    framebuffer_device_t *dev = &ctx->device;
 
     private_module_t* m = (private_module_t*)module;
     status = init_fb(m);
     if (status < 0) {
         ALOGE("Fail to init framebuffer");
-        free(dev);
+        free(ctx);
         gralloc_close(gralloc_device);
         return status;
     }
 
     /* initialize our state here */
-    memset(dev, 0, sizeof(*dev));
+    memset(ctx, 0, sizeof(*ctx));
 
     /* initialize the procs */
     dev->common.tag = HARDWARE_DEVICE_TAG;
@@ -251,7 +439,12 @@ int fb_device_open(hw_module_t const* module, const char* name,
     dev->common.close = fb_close;
     dev->setSwapInterval = 0;
     dev->post = fb_post;
+#if HWC_EXIST
     dev->setUpdateRect = 0;
+#else
+    /* partial updates only help the copy, a flip always shows a whole screen */
+    dev->setUpdateRect = (m->flags & private_module_t::PAGE_FLIP) ? 0 : fb_setUpdateRect;
+#endif
     dev->compositionComplete = 0;
 #if HWC_EXIST
     m->queue = new hwc_callback_queue_t;
@@ -269,6 +462,7 @@ int fb_device_open(hw_module_t const* module, const char* name,
     const_cast<float&>(dev->fps) = m->fps;
     const_cast<int&>(dev->minSwapInterval) = 1;
     const_cast<int&>(dev->maxSwapInterval) = 1;
+    const_cast<int&>(dev->numFramebuffers) = m->numBuffers;
     *device = &dev->common;
     status = 0;
 
@@ -41,4 +41,9 @@ int getIonFd(gralloc_module_t const *module);
 int grallocMap(gralloc_module_t const* module, private_handle_t *hnd);
 int grallocUnmap(private_handle_t *hnd);
 
+bool fb_is_framebuffer(private_module_t const* m, private_handle_t const* hnd);
+int fb_alloc_buffer(private_module_t* m, int w, int h, int format, int usage,
+                    private_handle_t** pHnd, int* pStride);
+void fb_free_buffer(private_module_t* m, private_handle_t* hnd);
+
 #endif /* GR_H_ */
@@ -14,13 +14,16 @@
  * limitations under the License.
  */
 
+#include <inttypes.h>
 #include <limits.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -32,6 +35,7 @@
 #include <exynos_ion.h>
 #include <log/log.h>
 #include <cutils/atomic.h>
+#include <cutils/properties.h>
 
 #include <hardware/hardware.h>
 #include <hardware/gralloc.h>
@@ -39,8 +43,12 @@
 #include "gralloc_priv.h"
 #include "exynos_format.h"
 #include "gr.h"
+#include "alloc_backend.h"
+#include "alloc_stats.h"
+#include "plane_layout.h"
 
 #define PRIV_SIZE 64
+#define PRIV_ALIGN 64
 
 #define MSCL_EXT_SIZE 512
 #define MSCL_ALIGN 128
@@ -71,6 +79,8 @@ int fb_device_open(const hw_module_t* module, const char* name,
 static int gralloc_device_open(const hw_module_t* module, const char* name,
                                hw_device_t** device);
 
+static int gralloc_perform(struct gralloc_module_t const* module, int operation, ...);
+
 extern int gralloc_lock(gralloc_module_t const* module,
                         buffer_handle_t handle, int usage,
                         int l, int t, int w, int h,
@@ -114,7 +124,7 @@ struct private_module_t HAL_MODULE_INFO_SYM = {
     .unregisterBuffer = gralloc_unregister_buffer,
     .lock = gralloc_lock,
     .unlock = gralloc_unlock,
-    .perform = NULL,
+    .perform = gralloc_perform,
     .lock_ycbcr = gralloc_lock_ycbcr,
     .validateBufferSize = NULL,
     .getTransportSize = NULL,
@@ -158,16 +168,281 @@ static unsigned int _select_heap(int usage)
     return heap_mask;
 }
 
+/*
+ * Where an allocation may go when its heap is exhausted. Rows are tried in
+ * order, a fallback heap can have a row of its own to chain further. A
+ * row never applies to usage in denied_usage: secure buffers must stay in
+ * their heap, and consumers that need physically contiguous memory can't
+ * take a scattered system heap buffer. Each row can be turned off with
+ * ro.vendor.gralloc.fallback.<name>=false.
+ *
+ * The contig and crypto heaps have no row. Contig holds protected buffers,
+ * which must stay in their secure region, and crypto is only used for
+ * GRALLOC_USAGE_PHYSICALLY_LINEAR. Every other heap is either scattered
+ * or a carveout reserved for one IP, so neither has a heap to fall back to.
+ */
+struct heap_fallback {
+    const char *name;
+    unsigned int heap_mask;
+    unsigned int fallback_mask;
+    unsigned int denied_usage;
+};
+
+static const struct heap_fallback heap_fallbacks[] = {
+#ifdef USES_EXYNOS_COMMON_GRALLOC
+    /* the camera carveout, every camera IP is behind a sysmmu */
+    { "camera", EXYNOS_ION_HEAP_CAMERA, ION_HEAP_SYSTEM_MASK,
+      GRALLOC_USAGE_PROTECTED | GRALLOC_USAGE_PHYSICALLY_LINEAR |
+      GRALLOC_USAGE_SECURE_CAMERA_RESERVED },
+#endif
+    { NULL, 0, 0, 0 },
+};
+
+/* rows in heap_fallbacks; HEAP_FALLBACKS leaves out the NULL one ending it */
+#define HEAP_FALLBACK_ROWS (sizeof(heap_fallbacks) / sizeof(heap_fallbacks[0]))
+#define HEAP_FALLBACKS (HEAP_FALLBACK_ROWS - 1)
+
+/*
+ * retries of the whole chain, doubling the delay each time; only for
+ * allocations of at least GRALLOC_RETRY_MIN_SIZE that failed with -ENOMEM,
+ * smaller ones don't need the compaction a retry waits for
+ */
+#ifndef GRALLOC_ALLOC_RETRIES
+#define GRALLOC_ALLOC_RETRIES 2
+#endif
+#define GRALLOC_RETRY_DELAY_US 1000
+#define GRALLOC_RETRY_MIN_SIZE (1024 * 1024)
+
+static pthread_once_t fallback_once = PTHREAD_ONCE_INIT;
+static bool fallback_enabled[HEAP_FALLBACK_ROWS];
+static int alloc_retries;
+
+static pthread_mutex_t fallback_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int fallback_fired[HEAP_FALLBACK_ROWS];
+static unsigned int fallback_succeeded[HEAP_FALLBACK_ROWS];
+static unsigned int retries_fired;
+static unsigned int retries_succeeded;
+
+static void _init_fallbacks(void)
+{
+    char prop[PROPERTY_VALUE_MAX];
+
+    for (size_t i = 0; heap_fallbacks[i].name; i++) {
+        snprintf(prop, sizeof(prop), "ro.vendor.gralloc.fallback.%s", heap_fallbacks[i].name);
+        fallback_enabled[i] = property_get_bool(prop, true);
+    }
+    alloc_retries = property_get_int32("ro.vendor.gralloc.alloc_retries", GRALLOC_ALLOC_RETRIES);
+}
+
+static void _count_fallback(unsigned int *fired, unsigned int *succeeded, bool ok)
+{
+    pthread_mutex_lock(&fallback_lock);
+    (*fired)++;
+    if (ok)
+        (*succeeded)++;
+    pthread_mutex_unlock(&fallback_lock);
+}
+
+static inline uint64_t _now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* one allocation from heap_mask, counted against the heap it came from */
+static int _alloc_from_heap(int ionfd, size_t size, unsigned int heap_mask,
+                            unsigned int ion_flags)
+{
+    uint64_t start = _now_ns();
+    int fd = gralloc_backend_alloc(ionfd, size, heap_mask, ion_flags);
+
+    gralloc_stats_heap(heap_mask, (fd >= 0) ? roundUpToPageSize(size) : 0, _now_ns() - start);
+    return fd;
+}
+
+/*
+ * tries heap_mask, then the fallback chain from it; the error of the last
+ * heap tried if all of them fail
+ */
+static int _alloc_fd_chain(int ionfd, size_t size, unsigned int heap_mask,
+                           unsigned int ion_flags, int usage)
+{
+    pthread_once(&fallback_once, _init_fallbacks);
+
+    int fd = _alloc_from_heap(ionfd, size, heap_mask, ion_flags);
+
+    for (size_t i = 0, hops = 0; (fd < 0) && heap_fallbacks[i].name && (hops < HEAP_FALLBACKS); i++) {
+        const struct heap_fallback *fb = &heap_fallbacks[i];
+
+        if (!fallback_enabled[i] || (fb->heap_mask != heap_mask) || (usage & fb->denied_usage))
+            continue;
+
+        fd = _alloc_from_heap(ionfd, size, fb->fallback_mask, ion_flags);
+        _count_fallback(&fallback_fired[i], &fallback_succeeded[i], fd >= 0);
+        if (fd >= 0) {
+            ALOGW("%s: heap %#x exhausted, %zu bytes from %#x instead", __func__,
+                  heap_mask, size, fb->fallback_mask);
+            break;
+        }
+
+        /* follow the chain from the fallback heap */
+        heap_mask = fb->fallback_mask;
+        i = (size_t)-1;
+        hops++;
+    }
+
+    return fd;
+}
+
+/*
+ * All buffer allocations go through here. When the heap and its fallback
+ * chain are all out of memory for a large buffer, retry a bounded number
+ * of times with a short backoff, giving the kernel a chance to reclaim
+ * and compact. Any other failure is returned right away.
+ */
+static int _alloc_fd(int ionfd, size_t size, unsigned int heap_mask,
+                     unsigned int ion_flags, int usage)
+{
+    int fd = _alloc_fd_chain(ionfd, size, heap_mask, ion_flags, usage);
+
+    for (int i = 0; (fd == -ENOMEM) && (size >= GRALLOC_RETRY_MIN_SIZE) &&
+                    (i < alloc_retries); i++) {
+        usleep(GRALLOC_RETRY_DELAY_US << i);
+        fd = _alloc_fd_chain(ionfd, size, heap_mask, ion_flags, usage);
+        _count_fallback(&retries_fired, &retries_succeeded, fd >= 0);
+    }
+
+    return fd;
+}
+
+/* appends the fallback counters to buff, for gralloc_dump */
+static int _dump_fallbacks(char *buff, int buff_len)
+{
+    int len;
+
+    pthread_mutex_lock(&fallback_lock);
+    len = snprintf(buff, buff_len, "alloc retries: %u, %u succeeded\n",
+                   retries_fired, retries_succeeded);
+    for (size_t i = 0; heap_fallbacks[i].name && len < buff_len; i++)
+        len += snprintf(buff + len, buff_len - len,
+                        "heap fallback %s (%#x -> %#x)%s: %u, %u succeeded\n",
+                        heap_fallbacks[i].name, heap_fallbacks[i].heap_mask,
+                        heap_fallbacks[i].fallback_mask,
+                        fallback_enabled[i] ? "" : " disabled",
+                        fallback_fired[i], fallback_succeeded[i]);
+    pthread_mutex_unlock(&fallback_lock);
+
+    return len;
+}
+
+/*
+ * Padding added to a plane on top of the image itself. The default is
+ * what every buffer used to get; with GRALLOC_ALIGN_POLICY only the
+ * padding the consumers in the usage bits need is applied.
+ */
+struct gralloc_padding {
+    int w_align;        /* stride alignment, pixels */
+    int h_align;        /* vstride alignment, rows */
+    int extra_rows;     /* rows the h/w may read past the image */
+    size_t ext_size;    /* bytes the h/w may read past the plane */
+    bool mscl_ext;      /* MSC over-read when the width is not MSCL_ALIGN aligned */
+};
+
+static const struct gralloc_padding default_padding = { 16, 16, 2, 256, true };
+
+/* consumers that may scale or convert the buffer through the MSC */
+#define GRALLOC_USAGE_MSC_CONSUMERS (GRALLOC_USAGE_HW_2D | GRALLOC_USAGE_HW_COMPOSER | \
+                                     GRALLOC_USAGE_HW_VIDEO_ENCODER | GRALLOC_USAGE_HW_CAMERA_MASK)
+
+static void _select_padding(int usage, struct gralloc_padding *pad)
+{
+    *pad = default_padding;
+#ifdef GRALLOC_ALIGN_POLICY
+    /* nothing but the CPU: no h/w alignment and nothing to over-read */
+    if (!(usage & ~(GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK))) {
+        pad->w_align = 4;
+        pad->h_align = 1;
+        pad->extra_rows = 0;
+        pad->ext_size = 0;
+        pad->mscl_ext = false;
+        return;
+    }
+
+    /* DECON, GPU and MFC keep the default alignment, only MSC needs mscl_ext */
+    if (!(usage & GRALLOC_USAGE_MSC_CONSUMERS))
+        pad->mscl_ext = false;
+#else
+    (void)usage;
+#endif
+}
+
+#ifdef GRALLOC_ALIGN_POLICY
+static pthread_mutex_t padding_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int padding_buffers;
+static uint64_t padding_saved;
+
+/* bytes not allocated thanks to the alignment policy, for gralloc_dump */
+static void _account_padding(size_t default_size, size_t size)
+{
+    if (default_size <= size)
+        return;
+
+    pthread_mutex_lock(&padding_lock);
+    padding_buffers++;
+    padding_saved += default_size - size;
+    pthread_mutex_unlock(&padding_lock);
+}
+#endif
+
+static size_t _rgb_size(int w, int h, int bpp, const struct gralloc_padding *pad,
+                        int *stride, int *vstride)
+{
+    size_t bpr = ALIGN(w, pad->w_align) * bpp;
+    size_t size;
+
+    *vstride = ALIGN(h, pad->h_align);
+
+    if (*vstride < h + pad->extra_rows)
+        size = bpr * (h + pad->extra_rows);
+    else
+        size = bpr * *vstride;
+
+    *stride = bpr / bpp;
+    size = size + pad->ext_size;
+#ifdef GRALLOC_MSCL_ALIGN_RESTRICTION
+    if (pad->mscl_ext && (w % MSCL_ALIGN))
+        size += MSCL_EXT_SIZE;
+#endif
+
+    return size;
+}
+
+/*
+ * Header plus worst-case (uncompressed) body of an AFBC buffer made of
+ * 16x16 superblocks.
+ */
+static size_t _afbc_size(int w, int h, int bits_per_pixel)
+{
+    size_t nblocks = (ALIGN(w, AFBC_PIXELS_PER_BLOCK) / AFBC_PIXELS_PER_BLOCK) *
+                     (ALIGN(h, AFBC_PIXELS_PER_BLOCK) / AFBC_PIXELS_PER_BLOCK);
+    size_t block_size = AFBC_PIXELS_PER_BLOCK * AFBC_PIXELS_PER_BLOCK * bits_per_pixel / 8;
+
+    return ALIGN(nblocks * AFBC_HEADER_BUFFER_BYTES_PER_BLOCKENTRY, AFBC_BODY_BUFFER_BYTE_ALIGNMENT) +
+           nblocks * block_size;
+}
+
 /*
  * Define GRALLOC_ARM_FORMAT_SELECTION_DISABLE to disable the format selection completely
  */
 static int gralloc_alloc_rgb(int ionfd, int w, int h, int format, int usage,
                              unsigned int ion_flags, private_handle_t **hnd, int *stride)
 {
-    size_t bpr = 0, ext_size=256, size = 0;
+    size_t size = 0;
     int bpp = 0, vstride = 0;
     int fd = -1;
-    uint32_t nblocks = 0;
+    struct gralloc_padding pad;
 
     unsigned int heap_mask = _select_heap(usage);
     int is_compressible = check_for_compression(w, h, format, usage);
@@ -203,32 +478,26 @@ static int gralloc_alloc_rgb(int ionfd, int w, int h, int format, int usage,
     }
 
     if (format != HAL_PIXEL_FORMAT_BLOB) {
-        bpr = ALIGN(w, 16)* bpp;
-        vstride = ALIGN(h, 16);
-
-        if (vstride < h + 2)
-            size = bpr * (h + 2);
-        else
-            size = bpr * vstride;
+        _select_padding(usage, &pad);
+        size = _rgb_size(w, h, bpp, &pad, stride, &vstride);
+#ifdef GRALLOC_ALIGN_POLICY
+        int default_stride, default_vstride;
+        _account_padding(_rgb_size(w, h, bpp, &default_padding, &default_stride, &default_vstride),
+                         size);
+#endif
 
-        *stride = bpr / bpp;
-        size = size + ext_size;
         if (is_compressible)
         {
             /* if is_compressible = 1, width is alread 16 align so we can use width instead of w_aligned*/
-            int h_aligned = ALIGN( h, AFBC_PIXELS_PER_BLOCK );
-            nblocks = *stride / AFBC_PIXELS_PER_BLOCK * h_aligned / AFBC_PIXELS_PER_BLOCK;
-
-            size = *stride * h_aligned * bpp +
-                ALIGN( nblocks * AFBC_HEADER_BUFFER_BYTES_PER_BLOCKENTRY, AFBC_BODY_BUFFER_BYTE_ALIGNMENT ) + ext_size;
+            size = _afbc_size(*stride, h, bpp * 8) + pad.ext_size;
+#ifdef GRALLOC_MSCL_ALIGN_RESTRICTION
+            if (pad.mscl_ext && (w % MSCL_ALIGN))
+                size += MSCL_EXT_SIZE;
+#endif
 
             /* Memory must be zeroed for using mmap during afbc header initialization */
             ion_flags &= ~ION_FLAG_NOZEROED;
         }
-#ifdef GRALLOC_MSCL_ALIGN_RESTRICTION
-        if (w % MSCL_ALIGN)
-            size += MSCL_EXT_SIZE;
-#endif
     }
 
     if (usage & GRALLOC_USAGE_PROTECTED) {
@@ -247,7 +516,7 @@ static int gralloc_alloc_rgb(int ionfd, int w, int h, int format, int usage,
         ion_flags |= ION_FLAG_PROTECTED;
     }
 
-    fd = exynos_ion_alloc(ionfd, size, heap_mask, ion_flags);
+    fd = _alloc_fd(ionfd, size, heap_mask, ion_flags, usage);
     if (fd < 0)
     {
         ALOGE("failed to get fd from exynos_ion_alloc, %s, %d\n", __func__, __LINE__);
@@ -264,10 +533,15 @@ static int gralloc_alloc_framework_yuv(int ionfd, int w, int h, int format, int
                                        int usage, unsigned int ion_flags,
                                        private_handle_t **hnd, int *stride)
 {
-    size_t size=0, ext_size=256;
+    size_t size=0, ext_size;
     int fd = -1;
     unsigned int heap_mask = _select_heap(usage);
     int is_compressible = 0;
+    struct gralloc_padding pad;
+
+    /* the layout is fixed by the framework, only the trailing padding can go */
+    _select_padding(usage, &pad);
+    ext_size = pad.ext_size;
 
     switch (format) {
         case HAL_PIXEL_FORMAT_YV12:
@@ -293,14 +567,25 @@ static int gralloc_alloc_framework_yuv(int ionfd, int w, int h, int format, int
     }
 
 #ifdef GRALLOC_MSCL_ALIGN_RESTRICTION
-    if (w % MSCL_ALIGN)
+    if (pad.mscl_ext && (w % MSCL_ALIGN))
         size += MSCL_EXT_SIZE;
 #endif
 
+#ifdef GRALLOC_ALIGN_POLICY
+    {
+        size_t default_size = size + (default_padding.ext_size - pad.ext_size);
+#ifdef GRALLOC_MSCL_ALIGN_RESTRICTION
+        if (!pad.mscl_ext && (w % MSCL_ALIGN))
+            default_size += MSCL_EXT_SIZE;
+#endif
+        _account_padding(default_size, size);
+    }
+#endif
+
     if (frameworkFormat == HAL_PIXEL_FORMAT_YCbCr_420_888)
         *stride = 0;
 
-    fd = exynos_ion_alloc(ionfd, size, heap_mask, ion_flags);
+    fd = _alloc_fd(ionfd, size, heap_mask, ion_flags, usage);
     if (fd < 0)
     {
         ALOGE("failed to get fd from exynos_ion_alloc, %s, %d\n", __func__, __LINE__);
@@ -316,7 +601,7 @@ static int gralloc_alloc_yuv(int ionfd, int w, int h, int format,
                              int usage, unsigned int ion_flags,
                              private_handle_t **hnd, int *stride)
 {
-    size_t luma_size=0, chroma_size=0, ext_size=256;
+    size_t luma_size=0, chroma_size=0, ext_size=GRALLOC_PLANE_EXT_SIZE;
     int planes = 0, fd = -1, fd1 = -1, fd2 = -1;
     size_t luma_vstride = 0;
     unsigned int heap_mask = _select_heap(usage);
@@ -325,6 +610,7 @@ static int gralloc_alloc_yuv(int ionfd, int w, int h, int format,
     int is_compressible = 0;
     uint64_t internal_format = 0;
     int size = 0, size1 = 0, size2 = 0;
+    size_t priv_offset = 0;
 
     *stride = ALIGN(w, 16);
     luma_vstride = ALIGN(h, 16);
@@ -444,19 +730,19 @@ static int gralloc_alloc_yuv(int ionfd, int w, int h, int format,
         case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B:
             {
 #ifdef GRALLOC_10B_ALIGN_RESTRICTION
-                luma_size = (*stride * luma_vstride + ext_size) + ((ALIGN(w / 4, 16) * luma_vstride) + ext_size);
-                chroma_size = (*stride * luma_vstride / 2 + ext_size) + ((ALIGN(w / 4, 16) * (luma_vstride / 2)) + ext_size);
+                luma_size = (*stride * luma_vstride + ext_size) + ((GRALLOC_2B_STRIDE(w) * luma_vstride) + ext_size);
+                chroma_size = (*stride * luma_vstride / 2 + ext_size) + ((GRALLOC_2B_STRIDE(w) * (luma_vstride / 2)) + ext_size);
 #else
-                luma_size = (*stride * luma_vstride + ext_size) + ((ALIGN(w / 4, 16) * h) + ext_size);
-                chroma_size = (*stride * luma_vstride / 2 + ext_size) + ((ALIGN(w / 4, 16) * (h / 2)) + ext_size);
+                luma_size = (*stride * luma_vstride + ext_size) + ((GRALLOC_2B_STRIDE(w) * h) + ext_size);
+                chroma_size = (*stride * luma_vstride / 2 + ext_size) + ((GRALLOC_2B_STRIDE(w) * (h / 2)) + ext_size);
 #endif
                 planes = 3;
                 break;
             }
         case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_S10B:
             {
-                chroma_size = ALIGN((*stride * luma_vstride / 2) + ext_size, 16) + (ALIGN(w / 4, 16) * (luma_vstride / 2)) + 64;
-                luma_size = (*stride * luma_vstride) + ext_size + (ALIGN(w / 4, 16) * luma_vstride) + 64 + chroma_size;
+                chroma_size = ALIGN((*stride * luma_vstride / 2) + ext_size, 16) + (GRALLOC_2B_STRIDE(w) * (luma_vstride / 2)) + 64;
+                luma_size = (*stride * luma_vstride) + ext_size + (GRALLOC_2B_STRIDE(w) * luma_vstride) + 64 + chroma_size;
                 planes = 1;
                 break;
             }
@@ -474,18 +760,87 @@ static int gralloc_alloc_yuv(int ionfd, int w, int h, int format,
 
 #ifdef GRALLOC_MSCL_ALIGN_RESTRICTION
     if (w % MSCL_ALIGN) {
-        luma_size += MSCL_EXT_SIZE;
-        chroma_size += MSCL_EXT_SIZE/2;
+        /* strides and ext_size are fixed by MFC/lock, only this is optional */
+        struct gralloc_padding pad;
+
+        _select_padding(usage, &pad);
+        if (pad.mscl_ext) {
+            luma_size += MSCL_EXT_SIZE;
+            chroma_size += MSCL_EXT_SIZE/2;
+        }
+#ifdef GRALLOC_ALIGN_POLICY
+        else
+            _account_padding(MSCL_EXT_SIZE + ((planes > 1) ? MSCL_EXT_SIZE/2 : 0), 0);
+#endif
+    }
+#endif
+
+#ifdef GRALLOC_SINGLE_ALLOC_YUV
+    /*
+     * all planes in one dma-buf, each plane starting on its own page; the
+     * handle is marked LAYOUT_PACKED_PLANES and only keeps the plane
+     * sizes, getPlaneOffset() works the offsets back out of them
+     */
+    if ((planes > 1) && !(usage & GRALLOC_USAGE_PROTECTED)) {
+        size_t offset1 = roundUpToPageSize(luma_size);
+        size_t offset2 = offset1 + roundUpToPageSize(chroma_size);
+
+        size1 = chroma_size;
+        if (planes == 3) {
+            if ((format == HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_PRIV) ||
+                (format == HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B))
+                size2 = PRIV_SIZE;
+            else
+                size2 = chroma_size;
+            size = offset2 + size2;
+        } else {
+            size = offset1 + size1;
+        }
+
+        fd = _alloc_fd(ionfd, size, heap_mask, ion_flags, usage);
+        if (fd < 0) {
+            ALOGE("failed to get fd from exynos_ion_alloc, %s, %d\n", __func__, __LINE__);
+            return -EINVAL;
+        }
+
+        *hnd = new private_handle_t(fd, size, usage, w, h,
+                                    format, internal_format, frameworkFormat, *stride, luma_vstride, is_compressible);
+        (*hnd)->size1 = size1;
+        (*hnd)->size2 = size2;
+        (*hnd)->layout = private_handle_t::LAYOUT_PACKED_PLANES;
+        return 0;
+    }
+#endif
+
+#ifdef GRALLOC_EMBEDDED_PRIV
+    /*
+     * Keep the 64-byte metadata at the end of the luma buffer instead of
+     * allocating, importing and mapping a page of its own for it. Secure
+     * luma can't be mapped by the CPU, so protected buffers keep fd2.
+     * The metadata must start out zeroed like the fd2 page it replaces.
+     */
+    if ((planes == 3) && !(usage & GRALLOC_USAGE_PROTECTED) &&
+        ((format == HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_PRIV) ||
+         (format == HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B))) {
+        priv_offset = ALIGN(luma_size, PRIV_ALIGN);
+        luma_size = priv_offset + PRIV_SIZE;
+        planes = 2;
+        ion_flags &= ~ION_FLAG_NOZEROED;
     }
 #endif
 
     size = luma_size;
-    fd = exynos_ion_alloc(ionfd, size, heap_mask, ion_flags);
+    /* a DPB tries the MFC output region below before any backoff */
+    if (usage & GRALLOC_USAGE_PROTECTED_DPB)
+        fd = _alloc_fd_chain(ionfd, size, heap_mask, ion_flags, usage);
+    else
+        fd = _alloc_fd(ionfd, size, heap_mask, ion_flags, usage);
     if (fd < 0) {
         if (usage & GRALLOC_USAGE_PROTECTED_DPB) {
             ion_flags &= ~ION_EXYNOS_VIDEO_EXT2_MASK;
             ion_flags |= ION_EXYNOS_MFC_OUTPUT_MASK;
-            fd = exynos_ion_alloc(ionfd, size, heap_mask, ion_flags);
+            fd = _alloc_fd(ionfd, size, heap_mask, ion_flags, usage);
+            gralloc_stats_dpb_fallback(fd >= 0);
             if (fd < 0)
             {
                 ALOGE("failed to get fd from exynos_ion_alloc, %s, %d\n", __func__, __LINE__);
@@ -502,7 +857,7 @@ static int gralloc_alloc_yuv(int ionfd, int w, int h, int format,
                                     format, internal_format, frameworkFormat, *stride, luma_vstride, is_compressible);
     } else {
         size1 = chroma_size;
-        fd1 = exynos_ion_alloc(ionfd, size1, heap_mask, ion_flags);
+        fd1 = _alloc_fd(ionfd, size1, heap_mask, ion_flags, usage);
         if (fd1 < 0)
         {
             ALOGE("failed to get fd from exynos_ion_alloc, %s, %d\n", __func__, __LINE__);
@@ -514,10 +869,10 @@ static int gralloc_alloc_yuv(int ionfd, int w, int h, int format,
             if ((format == HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_PRIV) ||
                 (format == HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B)) {
                 size2 = PRIV_SIZE;
-                fd2 = exynos_ion_alloc(ionfd, size2, ION_HEAP_SYSTEM_MASK, 0);
+                fd2 = _alloc_fd(ionfd, size2, ION_HEAP_SYSTEM_MASK, 0, usage);
             } else {
                 size2 = chroma_size;
-                fd2 = exynos_ion_alloc(ionfd, size2, heap_mask, ion_flags);
+                fd2 = _alloc_fd(ionfd, size2, heap_mask, ion_flags, usage);
             }
             if (fd2 < 0)
             {
@@ -532,6 +887,11 @@ static int gralloc_alloc_yuv(int ionfd, int w, int h, int format,
         } else {
             *hnd = new private_handle_t(fd, fd1, size, size1, usage, w, h,
                                         format, internal_format, frameworkFormat, *stride, luma_vstride, is_compressible);
+            /* getEmbeddedMetadataOffset() finds it at size - size2 */
+            if (priv_offset) {
+                (*hnd)->size2 = PRIV_SIZE;
+                (*hnd)->layout = private_handle_t::LAYOUT_EMBEDDED_METADATA;
+            }
         }
     }
 
@@ -565,6 +925,14 @@ static int gralloc_alloc(alloc_device_t* dev,
     private_module_t* m = reinterpret_cast<private_module_t*>
         (dev->common.module);
 
+    /* a screen of fb0 if one is free, so fb_post can flip to it (non-Treble only) */
+    if ((usage & GRALLOC_USAGE_HW_FB) &&
+        !fb_alloc_buffer(m, w, h, format, usage, &hnd, &stride)) {
+        *pHandle = hnd;
+        *pStride = stride;
+        return 0;
+    }
+
     err = gralloc_alloc_rgb(m->ionfd, w, h, format, usage, ion_flags, &hnd,
                             &stride);
     if (err)
@@ -573,10 +941,12 @@ static int gralloc_alloc(alloc_device_t* dev,
     if (err)
         goto err;
 
+    gralloc_stats_add_buffer(hnd);
     *pHandle = hnd;
     *pStride = stride;
     return 0;
 err:
+    gralloc_stats_failure(usage, format);
     if (!hnd)
         return err;
     close(hnd->fd);
@@ -588,6 +958,30 @@ err:
     return err;
 }
 
+static int gralloc_perform(struct gralloc_module_t const* __unused module, int operation, ...)
+{
+    int err = -EINVAL;
+    va_list args;
+
+    va_start(args, operation);
+    switch (operation) {
+        case GRALLOC_MODULE_PERFORM_DUMP_STATS:
+            {
+                char *buff = va_arg(args, char *);
+                int buff_len = va_arg(args, int);
+
+                if (buff ? buff_len > 0 : buff_len == 0)
+                    err = gralloc_stats_dump_json(buff, buff_len);
+                break;
+            }
+        default:
+            break;
+    }
+    va_end(args);
+
+    return err;
+}
+
 static int gralloc_free(alloc_device_t* dev,
                         buffer_handle_t handle)
 {
@@ -597,15 +991,23 @@ static int gralloc_free(alloc_device_t* dev,
     private_handle_t const* hnd = reinterpret_cast<private_handle_t const*>(handle);
     gralloc_module_t* module = reinterpret_cast<gralloc_module_t*>(
                                                                    dev->common.module);
-    if (hnd->base)
-        grallocUnmap(const_cast<private_handle_t*>(hnd));
+
+    /* screens of fb0 are views into the framebuffer mapping, just give the slot back */
+    private_module_t* m = reinterpret_cast<private_module_t*>(module);
+    if (fb_is_framebuffer(m, hnd)) {
+        fb_free_buffer(m, const_cast<private_handle_t*>(hnd));
+        return 0;
+    }
+
+    gralloc_stats_remove_buffer(hnd);
+    grallocUnmap(const_cast<private_handle_t*>(hnd));
 
     if (hnd->handle)
-        exynos_ion_free_handle(getIonFd(module), hnd->handle);
+        gralloc_backend_free_handle(getIonFd(module), hnd->handle);
     if (hnd->handle1)
-        exynos_ion_free_handle(getIonFd(module), hnd->handle1);
+        gralloc_backend_free_handle(getIonFd(module), hnd->handle1);
     if (hnd->handle2)
-        exynos_ion_free_handle(getIonFd(module), hnd->handle2);
+        gralloc_backend_free_handle(getIonFd(module), hnd->handle2);
 
     close(hnd->fd);
     if (hnd->fd1 >= 0)
@@ -617,6 +1019,27 @@ static int gralloc_free(alloc_device_t* dev,
     return 0;
 }
 
+static void gralloc_dump(alloc_device_t* __unused dev, char *buff, int buff_len)
+{
+    if (!buff || buff_len <= 0)
+        return;
+
+    buff[0] = '\0';
+    int len = 0;
+#ifdef GRALLOC_ALIGN_POLICY
+    pthread_mutex_lock(&padding_lock);
+    len = snprintf(buff, buff_len,
+                   "alignment policy: %u buffers trimmed, %" PRIu64 " KB of padding saved\n",
+                   padding_buffers, padding_saved / 1024);
+    pthread_mutex_unlock(&padding_lock);
+#endif
+
+    if (len >= 0 && len < buff_len)
+        len += gralloc_stats_dump(buff + len, buff_len - len);
+    if (len >= 0 && len < buff_len)
+        len += _dump_fallbacks(buff + len, buff_len - len);
+}
+
 /*****************************************************************************/
 
 static int gralloc_close(struct hw_device_t *dev)
@@ -650,10 +1073,11 @@ int gralloc_device_open(const hw_module_t* module, const char* name,
 
         dev->device.alloc = gralloc_alloc;
         dev->device.free = gralloc_free;
+        dev->device.dump = gralloc_dump;
 
         private_module_t *p = reinterpret_cast<private_module_t*>(dev->device.common.module);
         if (p->ionfd == -1)
-            p->ionfd = exynos_ion_open();
+            p->ionfd = gralloc_backend_open();
 
         *device = &dev->device.common;
         status = 0;
@@ -26,6 +26,7 @@
 
 #include <log/log.h>
 #include <cutils/atomic.h>
+#include <cutils/properties.h>
 
 #include <hardware/hardware.h>
 #include <hardware/gralloc.h>
@@ -36,7 +37,11 @@
 #include <linux/ion.h>
 #include <exynos_ion.h>
 #include "gralloc_priv.h"
+#include "gr.h"
 #include "exynos_format.h"
+#include "alloc_backend.h"
+#include "alloc_stats.h"
+#include "plane_layout.h"
 
 #define INT_TO_PTR(var) ((void *)(unsigned long)var)
 #define MSCL_EXT_SIZE 512
@@ -44,6 +49,10 @@
 
 #define PRIV_SIZE 64
 
+#ifndef GRALLOC_PREFAULT_MIN_KB
+#define GRALLOC_PREFAULT_MIN_KB 1024
+#endif
+
 #include "format_chooser.h"
 
 /*****************************************************************************/
@@ -51,69 +60,150 @@ int getIonFd(gralloc_module_t const *module)
 {
     private_module_t* m = const_cast<private_module_t*>(reinterpret_cast<const private_module_t*>(module));
     if (m->ionfd == -1)
-        m->ionfd = exynos_ion_open();
+        m->ionfd = gralloc_backend_open();
     return m->ionfd;
 }
 
+static inline bool has_priv_plane(const private_handle_t *hnd)
+{
+    return (hnd->format == HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_PRIV) ||
+           (hnd->format == HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B);
+}
+
+static pthread_once_t prefault_once = PTHREAD_ONCE_INIT;
+static size_t prefault_min_bytes;
+
+static void _init_prefault(void)
+{
+    prefault_min_bytes = (size_t)property_get_int32("ro.vendor.gralloc.prefault_min_kb",
+                                                    GRALLOC_PREFAULT_MIN_KB) * 1024;
+}
+
+/*
+ * Large planes the CPU goes through often, like camera buffers read for
+ * JPEG and thumbnails, are mapped populated. Otherwise the first pass
+ * over them takes one fault per page; cached ION buffers are mapped by
+ * fault. ro.vendor.gralloc.prefault_min_kb = 0 turns this off.
+ */
+static bool gralloc_want_prefault(const private_handle_t *hnd, int size)
+{
+    pthread_once(&prefault_once, _init_prefault);
+    if (!prefault_min_bytes || (size_t)size < prefault_min_bytes)
+        return false;
+
+    return (hnd->flags & GRALLOC_USAGE_SW_READ_MASK) == GRALLOC_USAGE_SW_READ_OFTEN ||
+           (hnd->flags & GRALLOC_USAGE_SW_WRITE_MASK) == GRALLOC_USAGE_SW_WRITE_OFTEN;
+}
+
+/* Maps one plane unless it is already mapped in this process */
+static int gralloc_map_plane(gralloc_module_t const* module, int fd, int size,
+                             off_t offset, uint64_t *base, bool prefault)
+{
+    if (*base)
+        return 0;
+
+    void *mappedAddress = mmap(0, size, PROT_READ|PROT_WRITE,
+                               MAP_SHARED | (prefault ? MAP_POPULATE : 0), fd, offset);
+    if (mappedAddress == MAP_FAILED) {
+        ALOGE("%s: could not mmap %s", __func__, strerror(errno));
+        return -errno;
+    }
+    *base = (uint64_t)mappedAddress;
+
+    if (offset)
+        gralloc_backend_sync_partial(getIonFd(module), fd, offset, size);
+    else
+        gralloc_backend_sync(getIonFd(module), fd);
+
+    return 0;
+}
+
+static void gralloc_unmap_plane(uint64_t *base, int size)
+{
+    if (!*base)
+        return;
+
+    if (munmap(INT_TO_PTR(*base), size) < 0) {
+        ALOGE("%s :could not unmap %s %#" PRIx64 " %d", __func__, strerror(errno), *base, size);
+    }
+    *base = 0;
+}
+
+/*
+ * Maps just the page(s) holding metadata embedded in the luma buffer, for
+ * buffers whose luma is never mapped.
+ */
+static int gralloc_map_priv_page(gralloc_module_t const* module, private_handle_t *hnd)
+{
+    off_t priv_offset = hnd->getEmbeddedMetadataOffset();
+    off_t in_page = priv_offset & (PAGE_SIZE - 1);
+    uint64_t page = 0;
+    int err;
+
+    err = gralloc_map_plane(module, hnd->fd, in_page + hnd->size2,
+                            priv_offset - in_page, &page, false);
+    if (err)
+        return err;
+
+    hnd->base2 = page + in_page;
+    return 0;
+}
+
+/*
+ * Creates the CPU mappings on first use. Planes that are already mapped
+ * are kept, so this is cheap to call on every lock.
+ */
 static int gralloc_map(gralloc_module_t const* module, buffer_handle_t handle)
 {
-    void *privAddress;
+    int err;
 
     private_handle_t *hnd = (private_handle_t*)handle;
-    hnd->base = hnd->base1 = hnd->base2 = 0;
 
-    switch (hnd->format) {
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_PRIV:
-        privAddress = mmap(0, hnd->size2, PROT_READ|PROT_WRITE, MAP_SHARED, hnd->fd2, 0);
-        if (privAddress == MAP_FAILED) {
-            ALOGE("%s: could not mmap %s", __func__, strerror(errno));
-        } else {
-            hnd->base2 = (uint64_t)privAddress;
-            exynos_ion_sync_fd(getIonFd(module), hnd->fd2);
-        }
-        break;
-    default:
-        break;
+    bool map_luma = !(hnd->flags & GRALLOC_USAGE_PROTECTED) && !(hnd->flags & GRALLOC_USAGE_NOZEROED);
+
+    /* The metadata plane is never secure, map it even for protected buffers */
+    if (has_priv_plane(hnd)) {
+        if (hnd->getPackedPlanes())
+            gralloc_map_plane(module, hnd->fd, hnd->size2, hnd->getPlaneOffset(2), &hnd->base2,
+                              false);
+        else if (hnd->getEmbeddedMetadataOffset() && !map_luma && !hnd->base2)
+            gralloc_map_priv_page(module, hnd);
+        else if (hnd->fd2 >= 0)
+            gralloc_map_plane(module, hnd->fd2, hnd->size2, 0, &hnd->base2, false);
     }
 
-    if ((hnd->flags & GRALLOC_USAGE_PROTECTED) &&
-            !(hnd->flags & GRALLOC_USAGE_PRIVATE_NONSECURE)) {
+    if (!map_luma)
+        return 0;
+
+    err = gralloc_map_plane(module, hnd->fd, hnd->size, 0, &hnd->base,
+                            gralloc_want_prefault(hnd, hnd->size));
+    if (err)
+        return err;
+
+    /* embedded metadata is a view into the luma mapping */
+    if (hnd->getEmbeddedMetadataOffset())
+        hnd->base2 = hnd->base + hnd->getEmbeddedMetadataOffset();
+
+    /* packed planes are views into the single mapping of fd */
+    int packed_planes = hnd->getPackedPlanes();
+    if (packed_planes) {
+        hnd->base1 = hnd->base + hnd->getPlaneOffset(1);
+        if ((packed_planes > 2) && !has_priv_plane(hnd))
+            hnd->base2 = hnd->base + hnd->getPlaneOffset(2);
         return 0;
     }
 
-    if (!(hnd->flags & GRALLOC_USAGE_PROTECTED) && !(hnd->flags & GRALLOC_USAGE_NOZEROED)) {
-        void* mappedAddress = mmap(0, hnd->size, PROT_READ|PROT_WRITE, MAP_SHARED,
-                                   hnd->fd, 0);
-        if (mappedAddress == MAP_FAILED) {
-            ALOGE("%s: could not mmap %s", __func__, strerror(errno));
-            return -errno;
-        }
-        hnd->base = (uint64_t)mappedAddress;
-        exynos_ion_sync_fd(getIonFd(module), hnd->fd);
-
-        if (hnd->fd1 >= 0) {
-            void *mappedAddress1 = (void*)mmap(0, hnd->size1, PROT_READ|PROT_WRITE,
-                                                MAP_SHARED, hnd->fd1, 0);
-            if (mappedAddress1 == MAP_FAILED) {
-                ALOGE("%s: could not mmap %s", __func__, strerror(errno));
-                return -errno;
-            }
-            hnd->base1 = (uint64_t)mappedAddress1;
-            exynos_ion_sync_fd(getIonFd(module), hnd->fd1);
-        }
-        if (hnd->fd2 >= 0) {
-            if ((hnd->format != HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_PRIV) &&
-                (hnd->format != HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B)) {
-                void *mappedAddress2 = (void*)mmap(0, hnd->size2, PROT_READ|PROT_WRITE, MAP_SHARED, hnd->fd2, 0);
-                if (mappedAddress2 == MAP_FAILED) {
-                    ALOGE("%s: could not mmap %s", __func__, strerror(errno));
-                    return -errno;
-                }
-                hnd->base2 = (uint64_t)mappedAddress2;
-                exynos_ion_sync_fd(getIonFd(module), hnd->fd2);
-            }
-        }
+    if (hnd->fd1 >= 0) {
+        err = gralloc_map_plane(module, hnd->fd1, hnd->size1, 0, &hnd->base1,
+                                gralloc_want_prefault(hnd, hnd->size1));
+        if (err)
+            return err;
+    }
+    if ((hnd->fd2 >= 0) && !has_priv_plane(hnd)) {
+        err = gralloc_map_plane(module, hnd->fd2, hnd->size2, 0, &hnd->base2,
+                                gralloc_want_prefault(hnd, hnd->size2));
+        if (err)
+            return err;
     }
 
     return 0;
@@ -123,43 +213,220 @@ static int gralloc_unmap(buffer_handle_t handle)
 {
     private_handle_t* hnd = (private_handle_t*)handle;
 
+    if (hnd->getPackedPlanes()) {
+        hnd->base1 = 0;
+        if (!has_priv_plane(hnd))
+            hnd->base2 = 0;
+    }
+
+    if (hnd->getEmbeddedMetadataOffset() && hnd->base2) {
+        if (hnd->base) {
+            hnd->base2 = 0;
+        } else {
+            off_t in_page = hnd->getEmbeddedMetadataOffset() & (PAGE_SIZE - 1);
+            uint64_t page = hnd->base2 - in_page;
+
+            gralloc_unmap_plane(&page, in_page + hnd->size2);
+            hnd->base2 = 0;
+        }
+    }
+
+    gralloc_unmap_plane(&hnd->base, hnd->size);
+    gralloc_unmap_plane(&hnd->base1, hnd->size1);
+    gralloc_unmap_plane(&hnd->base2, hnd->size2);
+
+    return 0;
+}
+
+/*****************************************************************************/
+
+static inline bool is_cached(const private_handle_t *hnd)
+{
+    return (hnd->flags & GRALLOC_USAGE_SW_READ_MASK) == GRALLOC_USAGE_SW_READ_OFTEN;
+}
+
+#ifdef GRALLOC_RANGE_FLUSH
+#define MAX_SYNC_RANGES 6
+
+struct sync_range {
+    int fd;
+    off_t offset;
+    size_t len;
+};
+
+static inline int add_rows(struct sync_range *ranges, int n, int fd, off_t start,
+                           size_t row_bytes, int first, int count)
+{
+    ranges[n].fd = fd;
+    ranges[n].offset = start + (off_t)first * row_bytes;
+    ranges[n].len = (size_t)count * row_bytes;
+    return n + 1;
+}
+
+/*
+ * Turns the locked rows [t, t + h) into the byte ranges they cover in
+ * every plane. Returns 0 when the layout is not row addressable and the
+ * whole buffer has to be synced.
+ */
+static int gralloc_lock_ranges(private_handle_t *hnd, int t, int h,
+                               struct sync_range *ranges)
+{
+    int n = 0;
+    int stride = hnd->stride;
+    /* 4:2:0 chroma rows touched by the luma rows */
+    int ct = t / 2;
+    int ch = (t + h + 1) / 2 - ct;
+    int fd1 = hnd->getPlaneFd(1);
+    int fd2 = hnd->getPlaneFd(2);
+    off_t offset1 = hnd->getPlaneOffset(1);
+    off_t offset2 = hnd->getPlaneOffset(2);
+    struct gralloc_layout layout;
+
+    /* AFBC superblocks don't map to rows */
+    if (hnd->is_compressible)
+        return 0;
+
     switch (hnd->format) {
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B:
+    case HAL_PIXEL_FORMAT_RGBA_FP16:
+        n = add_rows(ranges, n, hnd->fd, 0, stride * 8, t, h);
+        break;
+    case HAL_PIXEL_FORMAT_EXYNOS_ARGB_8888:
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+    case HAL_PIXEL_FORMAT_RGBX_8888:
+    case HAL_PIXEL_FORMAT_BGRA_8888:
+    case HAL_PIXEL_FORMAT_RGBA_1010102:
+        n = add_rows(ranges, n, hnd->fd, 0, stride * 4, t, h);
+        break;
+    case HAL_PIXEL_FORMAT_RGB_888:
+        n = add_rows(ranges, n, hnd->fd, 0, stride * 3, t, h);
+        break;
+    case HAL_PIXEL_FORMAT_RGB_565:
+    case HAL_PIXEL_FORMAT_RAW16:
+    case HAL_PIXEL_FORMAT_RAW_OPAQUE:
+    case HAL_PIXEL_FORMAT_YCbCr_422_I:
+    case HAL_PIXEL_FORMAT_Y16:
+        n = add_rows(ranges, n, hnd->fd, 0, stride * 2, t, h);
+        break;
+    case HAL_PIXEL_FORMAT_Y8:
+        n = add_rows(ranges, n, hnd->fd, 0, stride, t, h);
+        break;
+    case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+    case HAL_PIXEL_FORMAT_YV12:
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_P:
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M:
+    case HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M:
+    case HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_FULL:
     case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_PRIV:
-        if (munmap(INT_TO_PTR(hnd->base2), hnd->size2) < 0) {
-            ALOGE("%s :could not unmap %s %#" PRIx64 " %d", __func__, strerror(errno), hnd->base2, hnd->size2);
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B:
+    case HAL_PIXEL_FORMAT_EXYNOS_YV12_M:
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_P_M:
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN:
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_S10B:
+        gralloc_ycbcr_layout(hnd, &layout);
+        n = add_rows(ranges, n, hnd->fd, 0, layout.ystride, t, h);
+        if (layout.cstep == 2) {
+            /* interleaved chroma starts at whichever of cb/cr comes first */
+            n = add_rows(ranges, n, hnd->getPlaneFd(layout.cb_plane),
+                         hnd->getPlaneOffset(layout.cb_plane) +
+                         ((layout.cb_offset < layout.cr_offset) ?
+                          layout.cb_offset : layout.cr_offset),
+                         layout.cstride, ct, ch);
+        } else {
+            n = add_rows(ranges, n, hnd->getPlaneFd(layout.cb_plane),
+                         hnd->getPlaneOffset(layout.cb_plane) + layout.cb_offset,
+                         layout.cstride, ct, ch);
+            n = add_rows(ranges, n, hnd->getPlaneFd(layout.cr_plane),
+                         hnd->getPlaneOffset(layout.cr_plane) + layout.cr_offset,
+                         layout.cstride, ct, ch);
+        }
+        if (layout.stride2b) {
+            n = add_rows(ranges, n, hnd->fd, layout.y2b_offset, layout.stride2b, t, h);
+            n = add_rows(ranges, n, hnd->getPlaneFd(layout.cb_plane),
+                         hnd->getPlaneOffset(layout.cb_plane) + layout.c2b_offset,
+                         layout.stride2b, ct, ch);
         }
-        hnd->base2 = 0;
+        if (has_priv_plane(hnd))
+            n = add_rows(ranges, n, fd2, offset2, hnd->size2, 0, 1);
+        break;
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_P010_M:
+        n = add_rows(ranges, n, hnd->fd, 0, stride * 2, t, h);
+        n = add_rows(ranges, n, fd1, offset1, stride * 2, ct, ch);
+        n = add_rows(ranges, n, fd2, offset2, stride * 2, ct, ch);
         break;
     default:
+        /* BLOB, tiled and anything else: sync whole planes */
         break;
     }
 
-    if (!hnd->base)
-        return 0;
-
-    if (munmap(INT_TO_PTR(hnd->base), hnd->size) < 0) {
-        ALOGE("%s :could not unmap %s %#" PRIx64 " %d", __func__, strerror(errno), hnd->base, hnd->size);
-    }
-    hnd->base = 0;
+    return n;
+}
+#endif /* GRALLOC_RANGE_FLUSH */
 
-    if (hnd->fd1 >= 0) {
-        if (!hnd->base1)
-            return 0;
-        if (munmap(INT_TO_PTR(hnd->base1), hnd->size1) < 0) {
-            ALOGE("%s :could not unmap %s %#" PRIx64 " %d", __func__, strerror(errno), hnd->base1, hnd->size1);
-        }
-        hnd->base1 = 0;
-    }
-    if (hnd->fd2 >= 0) {
-        if (!hnd->base2)
-            return 0;
-        if (munmap(INT_TO_PTR(hnd->base2), hnd->size2) < 0) {
-            ALOGE("%s :could not unmap %s %#" PRIx64 " %d", __func__, strerror(errno), hnd->base2, hnd->size2);
+/* Cache maintenance for the region recorded by the last lock */
+static void gralloc_sync_locked(gralloc_module_t const* module, private_handle_t *hnd)
+{
+#ifdef GRALLOC_RANGE_FLUSH
+    int n = 0;
+    struct sync_range ranges[MAX_SYNC_RANGES];
+
+    if (hnd->lock_len > 0)
+        n = gralloc_lock_ranges(hnd, hnd->lock_offset, hnd->lock_len, ranges);
+
+    if (n > 0) {
+        for (int i = 0; i < n; i++) {
+            if (ranges[i].fd < 0 || ranges[i].len == 0)
+                continue;
+            gralloc_backend_sync_partial(getIonFd(module), ranges[i].fd,
+                                       ranges[i].offset, ranges[i].len);
         }
-        hnd->base2 = 0;
+        return;
     }
-    return 0;
+#endif
+
+    gralloc_backend_sync(getIonFd(module), hnd->fd);
+    if (hnd->fd1 >= 0)
+        gralloc_backend_sync(getIonFd(module), hnd->fd1);
+    if (hnd->fd2 >= 0)
+        gralloc_backend_sync(getIonFd(module), hnd->fd2);
+}
+
+/*
+ * Records the locked rows and access type for gralloc_unlock. Read locks
+ * of cached buffers sync the region here, so that unlock can skip cache
+ * maintenance entirely when the CPU did not write. Backends that bracket
+ * CPU access (dma-buf heaps) start it here and end it in unlock.
+ */
+static void gralloc_begin_cpu_access(gralloc_module_t const* module, private_handle_t *hnd,
+                                     int usage, int t, int h)
+{
+    if (t < 0)
+        t = 0;
+    if (t > hnd->height)
+        t = hnd->height;
+    if (h < 0 || t + h > hnd->height)
+        h = hnd->height - t;
+
+    hnd->lock_usage = usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK);
+    hnd->lock_offset = t;
+    hnd->lock_len = h;
+
+    gralloc_backend_begin_cpu_access(getIonFd(module), hnd->fd, hnd->lock_usage);
+    if (hnd->fd1 >= 0)
+        gralloc_backend_begin_cpu_access(getIonFd(module), hnd->fd1, hnd->lock_usage);
+    if (hnd->fd2 >= 0)
+        gralloc_backend_begin_cpu_access(getIonFd(module), hnd->fd2, hnd->lock_usage);
+
+    if (is_cached(hnd) && (usage & GRALLOC_USAGE_SW_READ_MASK))
+        gralloc_sync_locked(module, hnd);
+}
+
+static void gralloc_end_cpu_access(gralloc_module_t const* module, private_handle_t *hnd)
+{
+    gralloc_backend_end_cpu_access(getIonFd(module), hnd->fd, hnd->lock_usage);
+    if (hnd->fd1 >= 0)
+        gralloc_backend_end_cpu_access(getIonFd(module), hnd->fd1, hnd->lock_usage);
+    if (hnd->fd2 >= 0)
+        gralloc_backend_end_cpu_access(getIonFd(module), hnd->fd2, hnd->lock_usage);
 }
 
 /*****************************************************************************/
@@ -174,37 +441,73 @@ int grallocUnmap(private_handle_t *hnd)
     return gralloc_unmap(hnd);
 }
 
+static inline void *plane_address(const private_handle_t *hnd, int plane, int offset)
+{
+    uint64_t base;
+
+    switch (plane) {
+    case 0:
+        base = hnd->base;
+        break;
+    case 1:
+        base = hnd->base1;
+        break;
+    case 2:
+        base = hnd->base2;
+        break;
+    default:
+        return NULL;
+    }
+
+    return base ? (void *)((unsigned long)(base + offset)) : NULL;
+}
+
 /*****************************************************************************/
 
 int gralloc_register_buffer(gralloc_module_t const* module,
                             buffer_handle_t handle)
 {
-    int err;
     if (private_handle_t::validate(handle) < 0)
         return -EINVAL;
 
-    err = gralloc_map(module, handle);
-
+    /*
+     * Only import here. The CPU mappings are created by the first
+     * gralloc_lock/gralloc_lock_ycbcr, since most buffers are never
+     * touched by the CPU. The base addresses carried in the handle
+     * belong to the process that sent it.
+     */
     private_handle_t* hnd = (private_handle_t*)handle;
+
+    /* a screen of fb0 is a view into this process' framebuffer mapping */
+    private_module_t* m = (private_module_t*)module;
+    if (fb_is_framebuffer(m, hnd)) {
+        hnd->base = m->framebuffer->base + hnd->offset;
+        return 0;
+    }
+
+    hnd->base = hnd->base1 = hnd->base2 = 0;
+    hnd->lock_usage = hnd->lock_offset = hnd->lock_len = 0;
     ALOGV("%s: base %#" PRIx64 " %d %d %d %d\n", __func__, hnd->base, hnd->size,
           hnd->width, hnd->height, hnd->stride);
 
     int ret;
-    ret = exynos_ion_import_handle(getIonFd(module), hnd->fd, &hnd->handle);
+    ret = gralloc_backend_import_handle(getIonFd(module), hnd->fd, &hnd->handle);
     if (ret)
         ALOGE("error importing handle %d %x\n", hnd->fd, hnd->format);
     if (hnd->fd1 >= 0) {
-        ret = exynos_ion_import_handle(getIonFd(module), hnd->fd1, &hnd->handle1);
+        ret = gralloc_backend_import_handle(getIonFd(module), hnd->fd1, &hnd->handle1);
         if (ret)
             ALOGE("error importing handle1 %d %x\n", hnd->fd1, hnd->format);
     }
     if (hnd->fd2 >= 0) {
-        ret = exynos_ion_import_handle(getIonFd(module), hnd->fd2, &hnd->handle2);
+        ret = gralloc_backend_import_handle(getIonFd(module), hnd->fd2, &hnd->handle2);
         if (ret)
             ALOGE("error importing handle2 %d %x\n", hnd->fd2, hnd->format);
     }
 
-    return err;
+    gralloc_stats_add_buffer(hnd);
+
+    return 0;
 }
 
 int gralloc_unregister_buffer(gralloc_module_t const* module,
@@ -217,14 +520,18 @@ int gralloc_unregister_buffer(gralloc_module_t const* module,
     ALOGV("%s: base %#" PRIx64 " %d %d %d %d\n", __func__, hnd->base, hnd->size,
           hnd->width, hnd->height, hnd->stride);
 
+    if (fb_is_framebuffer((private_module_t*)module, hnd))
+        return 0;
+
+    gralloc_stats_remove_buffer(hnd);
     gralloc_unmap(handle);
 
     if (hnd->handle)
-        exynos_ion_free_handle(getIonFd(module), hnd->handle);
+        gralloc_backend_free_handle(getIonFd(module), hnd->handle);
     if (hnd->handle1)
-        exynos_ion_free_handle(getIonFd(module), hnd->handle1);
+        gralloc_backend_free_handle(getIonFd(module), hnd->handle1);
     if (hnd->handle2)
-        exynos_ion_free_handle(getIonFd(module), hnd->handle2);
+        gralloc_backend_free_handle(getIonFd(module), hnd->handle2);
 
     return 0;
 }
@@ -278,23 +585,8 @@ int gralloc_lock(gralloc_module_t const* module,
             return -EINVAL;
     }
 
-#ifdef GRALLOC_RANGE_FLUSH
-    if(usage & GRALLOC_USAGE_SW_WRITE_MASK)
-    {
-        hnd->lock_usage = GRALLOC_USAGE_SW_WRITE_RARELY;
-        hnd->lock_offset = t * hnd->stride;
-        hnd->lock_len = h * hnd->stride;
-    }
-    else
-    {
-        hnd->lock_usage = 0;
-        hnd->lock_offset = 0;
-        hnd->lock_len = 0;
-    }
-#endif
-
-    if (!hnd->base)
-        gralloc_map(module, hnd);
+    gralloc_map(module, hnd);
+    gralloc_begin_cpu_access(module, hnd, usage, t, h);
 
     *vaddr = INT_TO_PTR(hnd->base);
 
@@ -311,28 +603,16 @@ int gralloc_unlock(gralloc_module_t const* module,
 
     private_handle_t* hnd = (private_handle_t*)handle;
 
-    if (!((hnd->flags & GRALLOC_USAGE_SW_READ_MASK) == GRALLOC_USAGE_SW_READ_OFTEN))
-        return 0;
+    gralloc_end_cpu_access(module, hnd);
 
-#ifdef GRALLOC_RANGE_FLUSH
-    if(((hnd->format == HAL_PIXEL_FORMAT_RGBA_8888)
-         || (hnd->format == HAL_PIXEL_FORMAT_RGBX_8888)) && (hnd->lock_offset != 0))
-         exynos_ion_sync_fd_partial(getIonFd(module), hnd->fd, hnd->lock_offset * 4, hnd->lock_len * 4);
-    else
-        exynos_ion_sync_fd(getIonFd(module), hnd->fd);
+    if (!is_cached(hnd))
+        return 0;
 
-    if (hnd->fd1 >= 0)
-        exynos_ion_sync_fd(getIonFd(module), hnd->fd1);
-    if (hnd->fd2 >= 0)
-        exynos_ion_sync_fd(getIonFd(module), hnd->fd2);
-#else
-    exynos_ion_sync_fd(getIonFd(module), hnd->fd);
+    /* nothing to write back after a read-only lock */
+    if (hnd->lock_usage & GRALLOC_USAGE_SW_WRITE_MASK)
+        gralloc_sync_locked(module, hnd);
 
-    if (hnd->fd1 >= 0)
-        exynos_ion_sync_fd(getIonFd(module), hnd->fd1);
-    if (hnd->fd2 >= 0)
-        exynos_ion_sync_fd(getIonFd(module), hnd->fd2);
-#endif
+    hnd->lock_usage = 0;
 
     return 0;
 }
@@ -353,160 +633,44 @@ int gralloc_lock_ycbcr(gralloc_module_t const* module,
         return -EINVAL;
     }
 
-    int ext_size = 256;
-
     private_handle_t* hnd = (private_handle_t*)handle;
+    struct gralloc_layout layout;
 
-    if (!hnd->base)
-        gralloc_map(module, hnd);
+    gralloc_ycbcr_layout(hnd, &layout);
+    if (!layout.ystride) {
+        ALOGE("gralloc_lock_ycbcr unexpected internal format %x",
+                hnd->format);
+        return -EINVAL;
+    }
+
+    /* can't describe tiled format for user application */
+    if ((hnd->format == HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_TILED) &&
+        !(usage & GRALLOC_USAGE_HW_VIDEO_ENCODER)) {
+        ALOGE("gralloc_lock_ycbcr unexpected internal format %x",
+                hnd->format);
+        return -EINVAL;
+    }
+
+    gralloc_map(module, hnd);
 
     // If all CPU addresses are still NULL, do not anything.
     if (!hnd->base && !hnd->base1 && !hnd->base2)
         return 0;
 
-    // Calculate offsets to underlying YUV data
-    size_t yStride;
-    size_t cStride;
-    size_t uOffset;
-    size_t vOffset;
-    size_t cStep;
-    switch (hnd->format) {
-    case HAL_PIXEL_FORMAT_YCrCb_420_SP:
-        yStride = cStride = hnd->width;
-        vOffset = yStride * hnd->height;
-        uOffset = vOffset + 1;
-        cStep = 2;
-        ycbcr->y  = (void *)((unsigned long)hnd->base);
-        ycbcr->cb = (void *)(((unsigned long)hnd->base) + uOffset);
-        ycbcr->cr = (void *)(((unsigned long)hnd->base) + vOffset);
-        break;
-    case HAL_PIXEL_FORMAT_YV12:
-        yStride = ALIGN(hnd->width, 16);
-        cStride = ALIGN(yStride/2, 16);
-        vOffset = yStride * hnd->height;
-        uOffset = vOffset + (cStride * (hnd->height / 2));
-        cStep = 1;
-        ycbcr->y  = (void*)((unsigned long)hnd->base);
-        ycbcr->cr = (void*)(((unsigned long)hnd->base) + vOffset);
-        ycbcr->cb = (void*)(((unsigned long)hnd->base) + uOffset);
-        cStep = 1;
-        break;
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_PRIV:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B:
-        yStride = cStride = hnd->stride;
-        vOffset = 1;
-        cStep = 2;
-        ycbcr->y  = (void *)((unsigned long)hnd->base);
-        ycbcr->cb = (void *)((unsigned long)hnd->base1);
-        ycbcr->cr = (void *)(((unsigned long)hnd->base1) + vOffset);
-
-        if ((hnd->format != HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M) && (usage & GRALLOC_USAGE_HW_VIDEO_ENCODER))  /* usage name will be changed as GRALLOC_USAGE_HW_VIDEO since v2.0 */
-            ycbcr->cr = (void *)((unsigned long)hnd->base2);
-        break;
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_P:
-        yStride = hnd->stride;
-        cStride = ALIGN(yStride/2, 16);
-        uOffset = yStride * hnd->height;
-        vOffset = uOffset + (cStride * (hnd->height / 2));
-        cStep = 1;
-        ycbcr->y  = (void *)((unsigned long)hnd->base);
-        ycbcr->cb = (void*)(((unsigned long)hnd->base) + uOffset);
-        ycbcr->cr = (void*)(((unsigned long)hnd->base) + vOffset);
-        break;
-    /* separated color plane */
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_TILED:  /* can't describe tiled format for user application */
-        if (usage & GRALLOC_USAGE_HW_VIDEO_ENCODER) {  /* usage name will be changed as GRALLOC_USAGE_HW_VIDEO since v2.0 */
-            yStride = hnd->stride;
-            cStride = hnd->stride;
-            cStep   = 1;
-            ycbcr->y  = (void *)((unsigned long)hnd->base);
-            ycbcr->cb = (void *)((unsigned long)hnd->base1);
-            ycbcr->cr = NULL;
-        } else {
-            ALOGE("gralloc_lock_ycbcr unexpected internal format %x",
-                    hnd->format);
-            return -EINVAL;
-        }
-        break;
-    case HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M:
-    case HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_FULL:
-        yStride = cStride = hnd->stride;
-        uOffset = 1;
-        cStep = 2;
-        ycbcr->y  = (void *)((unsigned long)hnd->base);
-        ycbcr->cr = (void *)((unsigned long)hnd->base1);
-        ycbcr->cb = (void *)(((unsigned long)hnd->base1) + uOffset);
-        break;
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_P_M:
-        yStride = hnd->stride;
-        cStride = ALIGN(yStride/2, 16);
-        cStep = 1;
-        ycbcr->y  = (void *)((unsigned long)hnd->base);
-        ycbcr->cb = (void *)((unsigned long)hnd->base1);
-        ycbcr->cr = (void *)((unsigned long)hnd->base2);
-        break;
-    case HAL_PIXEL_FORMAT_EXYNOS_YV12_M:
-        yStride = hnd->stride;
-        cStride = ALIGN(yStride/2, 16);
-        cStep = 1;
-        ycbcr->y  = (void *)((unsigned long)hnd->base);
-        ycbcr->cr = (void *)((unsigned long)hnd->base1);
-        ycbcr->cb = (void *)((unsigned long)hnd->base2);
-        break;
-    case HAL_PIXEL_FORMAT_YCbCr_422_I:
-        yStride = cStride = hnd->stride;
-        cStep = 1;
-        ycbcr->y = (void *)((unsigned long)hnd->base);
-        ycbcr->cb = 0;
-        ycbcr->cr = 0;
-        break;
-    /* included h/w restrictions */
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN:
-        yStride = cStride = hnd->stride;
-        uOffset = (yStride * hnd->vstride) + ext_size;
-        vOffset = uOffset + 1;
-        cStep = 2;
-        ycbcr->y  = (void *)((unsigned long)hnd->base);
-        ycbcr->cb = (void *)(((unsigned long)hnd->base) + uOffset);
-        ycbcr->cr = (void *)(((unsigned long)hnd->base) + vOffset);
-        break;
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_S10B:
-        yStride = cStride = hnd->stride;
-        uOffset = ((yStride * hnd->vstride) + ext_size) + ((ALIGN(hnd->width / 4, 16) * hnd->vstride) + 64);
-        vOffset = uOffset + 1;
-        cStep = 2;
-        ycbcr->y  = (void *)((unsigned long)hnd->base);
-        ycbcr->cb = (void *)(((unsigned long)hnd->base) + uOffset);
-        ycbcr->cr = (void *)(((unsigned long)hnd->base) + vOffset);
-        break;
-    case HAL_PIXEL_FORMAT_Y8:
-    case HAL_PIXEL_FORMAT_Y16:
-        yStride = cStride = hnd->stride;
-        uOffset = 0;
-        vOffset = 0;
-        cStep = 1;
-        ycbcr->y  = (void *)((unsigned long)hnd->base);
-        ycbcr->cb = 0;
-        ycbcr->cr = 0;
-        break;
-    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_P010_M:
-        yStride = cStride = hnd->stride;
-        vOffset = 2;
-        cStep = 2;
-        ycbcr->y  = (void *)((unsigned long)hnd->base);
-        ycbcr->cb = (void *)((unsigned long)hnd->base1);
+    gralloc_begin_cpu_access(module, hnd, usage, t, h);
+
+    /* the layout was worked out when the buffer was allocated or registered */
+    ycbcr->y  = plane_address(hnd, 0, 0);
+    ycbcr->cb = plane_address(hnd, layout.cb_plane, layout.cb_offset);
+    ycbcr->cr = plane_address(hnd, layout.cr_plane, layout.cr_offset);
+
+    /* the encoder takes the PRIV/S10B metadata in cr */
+    if (has_priv_plane(hnd) && (usage & GRALLOC_USAGE_HW_VIDEO_ENCODER))  /* usage name will be changed as GRALLOC_USAGE_HW_VIDEO since v2.0 */
         ycbcr->cr = (void *)((unsigned long)hnd->base2);
-        break;
-    default:
-        ALOGE("gralloc_lock_ycbcr unexpected internal format %x",
-                hnd->format);
-        return -EINVAL;
-    }
 
-    ycbcr->ystride = yStride;
-    ycbcr->cstride = cStride;
-    ycbcr->chroma_step = cStep;
+    ycbcr->ystride = layout.ystride;
+    ycbcr->cstride = layout.cstride;
+    ycbcr->chroma_step = layout.cstep;
 
     // Zero out reserved fields
     memset(ycbcr->reserved, 0, sizeof(ycbcr->reserved));
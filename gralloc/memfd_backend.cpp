@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fake allocator backed by memfd, for running gralloc off-device (see
+ * benchmark/). Heap masks and ION flags are ignored; every buffer is
+ * plain shmem, so there is nothing to import and nothing to sync.
+ */
+
+#ifdef GRALLOC_MEMFD_BACKEND
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+#include <sys/syscall.h>
+
+#include <log/log.h>
+
+#include <linux/ion.h>
+
+#include "alloc_backend.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+static bool memfd_probe(void)
+{
+    return true;
+}
+
+static int memfd_open(void)
+{
+    /* no device node, hand out something that is not -1 */
+    return open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+static int memfd_alloc(int __unused devfd, size_t size, unsigned int __unused heap_mask,
+                       unsigned int __unused flags)
+{
+    int fd = syscall(__NR_memfd_create, "gralloc", MFD_CLOEXEC);
+
+    if (fd < 0) {
+        ALOGE("%s: memfd_create failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+
+    if (ftruncate(fd, size) < 0) {
+        int err = -errno;
+        ALOGE("%s: failed to size memfd to %zu bytes: %s", __func__, size, strerror(errno));
+        close(fd);
+        return err;
+    }
+
+    return fd;
+}
+
+static int memfd_import_handle(int __unused devfd, int __unused fd, ion_user_handle_t *handle)
+{
+    *handle = 0;
+    return 0;
+}
+
+static int memfd_free_handle(int __unused devfd, ion_user_handle_t __unused handle)
+{
+    return 0;
+}
+
+static int memfd_sync(int __unused devfd, int __unused fd)
+{
+    return 0;
+}
+
+static int memfd_sync_partial(int __unused devfd, int __unused fd, off_t __unused offset,
+                              size_t __unused len)
+{
+    return 0;
+}
+
+const struct alloc_backend memfd_alloc_backend = {
+    .name = "memfd",
+    .probe = memfd_probe,
+    .open = memfd_open,
+    .alloc = memfd_alloc,
+    .import_handle = memfd_import_handle,
+    .free_handle = memfd_free_handle,
+    .sync = memfd_sync,
+    .sync_partial = memfd_sync_partial,
+};
+
+#endif /* GRALLOC_MEMFD_BACKEND */
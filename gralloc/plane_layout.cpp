@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <log/log.h>
+
+#include <hardware/hardware.h>
+#include <hardware/gralloc.h>
+
+#include "gralloc_priv.h"
+#include "exynos_format.h"
+#include "plane_layout.h"
+
+static inline void set_layout(struct gralloc_layout *layout, int yStride, int cStride, int cStep,
+                              int cbPlane, int cbOffset, int crPlane, int crOffset)
+{
+    layout->ystride = yStride;
+    layout->cstride = cStride;
+    layout->cstep = cStep;
+    layout->cb_plane = cbPlane;
+    layout->cb_offset = cbOffset;
+    layout->cr_plane = crPlane;
+    layout->cr_offset = crOffset;
+    layout->y2b_offset = 0;
+    layout->c2b_offset = 0;
+    layout->stride2b = 0;
+}
+
+static inline void set_2b_layout(struct gralloc_layout *layout, int width,
+                                 int y2bOffset, int c2bOffset)
+{
+    layout->y2b_offset = y2bOffset;
+    layout->c2b_offset = c2bOffset;
+    layout->stride2b = GRALLOC_2B_STRIDE(width);
+}
+
+void gralloc_ycbcr_layout(const private_handle_t *hnd, struct gralloc_layout *layout)
+{
+    int ext_size = GRALLOC_PLANE_EXT_SIZE;
+    int yStride, cStride;
+    int uOffset, vOffset;
+
+    /* AFBC planes aren't addressable by the CPU */
+    if (hnd->is_compressible) {
+        set_layout(layout, 0, 0, 0, -1, 0, -1, 0);
+        return;
+    }
+
+    switch (hnd->format) {
+    case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+        yStride = hnd->width;
+        vOffset = yStride * hnd->height;
+        set_layout(layout, yStride, yStride, 2, 0, vOffset + 1, 0, vOffset);
+        break;
+    case HAL_PIXEL_FORMAT_YV12:
+        yStride = ALIGN(hnd->width, 16);
+        cStride = ALIGN(yStride / 2, 16);
+        vOffset = yStride * hnd->height;
+        uOffset = vOffset + (cStride * (hnd->height / 2));
+        set_layout(layout, yStride, cStride, 1, 0, uOffset, 0, vOffset);
+        break;
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M:
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_PRIV:
+        set_layout(layout, hnd->stride, hnd->stride, 2, 1, 0, 1, 1);
+        break;
+    /* each 8-bit plane is followed by its 2-bit plane */
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_S10B:
+        set_layout(layout, hnd->stride, hnd->stride, 2, 1, 0, 1, 1);
+        set_2b_layout(layout, hnd->width, (hnd->stride * hnd->vstride) + ext_size,
+                      (hnd->stride * hnd->vstride / 2) + ext_size);
+        break;
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_P:
+        yStride = hnd->stride;
+        cStride = ALIGN(yStride / 2, 16);
+        uOffset = yStride * hnd->height;
+        vOffset = uOffset + (cStride * (hnd->height / 2));
+        set_layout(layout, yStride, cStride, 1, 0, uOffset, 0, vOffset);
+        break;
+    /* can't describe tiled format for user application, encoder only */
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SP_M_TILED:
+        set_layout(layout, hnd->stride, hnd->stride, 1, 1, 0, -1, 0);
+        break;
+    case HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M:
+    case HAL_PIXEL_FORMAT_EXYNOS_YCrCb_420_SP_M_FULL:
+        set_layout(layout, hnd->stride, hnd->stride, 2, 1, 1, 1, 0);
+        break;
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_P_M:
+        set_layout(layout, hnd->stride, ALIGN(hnd->stride / 2, 16), 1, 1, 0, 2, 0);
+        break;
+    case HAL_PIXEL_FORMAT_EXYNOS_YV12_M:
+        set_layout(layout, hnd->stride, ALIGN(hnd->stride / 2, 16), 1, 2, 0, 1, 0);
+        break;
+    case HAL_PIXEL_FORMAT_YCbCr_422_I:
+    case HAL_PIXEL_FORMAT_Y8:
+    case HAL_PIXEL_FORMAT_Y16:
+        set_layout(layout, hnd->stride, hnd->stride, 1, -1, 0, -1, 0);
+        break;
+    /* included h/w restrictions */
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN:
+        uOffset = (hnd->stride * hnd->vstride) + ext_size;
+        set_layout(layout, hnd->stride, hnd->stride, 2, 0, uOffset, 0, uOffset + 1);
+        break;
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_420_SPN_S10B:
+        vOffset = (hnd->stride * hnd->vstride) + ext_size;
+        uOffset = vOffset + (GRALLOC_2B_STRIDE(hnd->width) * hnd->vstride) + 64;
+        set_layout(layout, hnd->stride, hnd->stride, 2, 0, uOffset, 0, uOffset + 1);
+        set_2b_layout(layout, hnd->width, vOffset,
+                      uOffset + ALIGN((hnd->stride * hnd->vstride / 2) + ext_size, 16));
+        break;
+    case HAL_PIXEL_FORMAT_EXYNOS_YCbCr_P010_M:
+        set_layout(layout, hnd->stride, hnd->stride, 2, 1, 0, 2, 0);
+        break;
+    default:
+        set_layout(layout, 0, 0, 0, -1, 0, -1, 0);
+        break;
+    }
+}
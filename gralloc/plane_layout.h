@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PLANE_LAYOUT_H_
+#define PLANE_LAYOUT_H_
+
+struct private_handle_t;
+
+/* bytes the MFC may read past the end of each YUV plane */
+#define GRALLOC_PLANE_EXT_SIZE 256
+
+/* row pitch of the packed 2-bit LSB planes of S10B formats */
+#define GRALLOC_2B_STRIDE(w) ALIGN((w) / 4, 16)
+
+/*
+ * Where the CPU finds each component of a YUV buffer. y is plane 0 at
+ * offset 0; cb/cr are a plane index (-1 if absent) and a byte offset into
+ * that plane. ystride is 0 for formats gralloc_lock_ycbcr can't describe.
+ * S10B formats also have packed 2-bit LSB planes: y2b in plane 0 and c2b
+ * in the cb plane, stride2b bytes per row. stride2b is 0 otherwise.
+ */
+struct gralloc_layout {
+    int ystride;
+    int cstride;
+    int cstep;
+    int cb_plane;
+    int cb_offset;
+    int cr_plane;
+    int cr_offset;
+    int y2b_offset;
+    int c2b_offset;
+    int stride2b;
+};
+
+/*
+ * Works out the layout from the handle's format, size, stride and vstride.
+ * Only marshalled fields are used, so it is the same in every process.
+ */
+void gralloc_ycbcr_layout(const private_handle_t *hnd, struct gralloc_layout *layout);
+
+#endif /* PLANE_LAYOUT_H_ */
@@ -0,0 +1,56 @@
+# Copyright (C) 2013 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+LOCAL_PATH := $(call my-dir)
+
+gralloc_convert_test_src_files := \
+	../format_convert.cpp \
+	../plane_layout.cpp \
+	format_convert_test.cpp
+
+gralloc_convert_test_c_includes := \
+	$(LOCAL_PATH)/.. \
+	$(LOCAL_PATH)/../../include \
+	$(TOP)/hardware/samsung_slsi/exynos/include \
+	$(TOP)/hardware/samsung_slsi/exynos5/include
+
+gralloc_convert_test_cflags := \
+	-DLOG_TAG=\"gralloc_convert_test\" -Wno-missing-field-initializers
+
+# On the device, to check the NEON paths
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := gralloc_convert_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_VENDOR_MODULE := true
+LOCAL_SRC_FILES := $(gralloc_convert_test_src_files)
+LOCAL_C_INCLUDES := $(gralloc_convert_test_c_includes)
+LOCAL_CFLAGS := $(gralloc_convert_test_cflags)
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_HEADER_LIBRARIES := libhardware_headers
+
+include $(BUILD_EXECUTABLE)
+
+# On the host, for the SSE2 paths
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := gralloc_convert_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := $(gralloc_convert_test_src_files)
+LOCAL_C_INCLUDES := $(gralloc_convert_test_c_includes)
+LOCAL_CFLAGS := $(gralloc_convert_test_cflags) -DPAGE_SIZE=4096
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_HEADER_LIBRARIES := libhardware_headers
+
+include $(BUILD_HOST_EXECUTABLE)
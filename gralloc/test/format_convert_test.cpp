@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that the NEON/SSE2 paths of format_convert.cpp give the same
+ * output, bit for bit, as its plain C loops. The converters built for
+ * this CPU are compared against a second copy of the file built with
+ * GRALLOC_CONVERT_NO_SIMD, on random images of widths that do and don't
+ * fill whole SIMD blocks and with padded strides. Exits non-zero on the
+ * first difference.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include <log/log.h>
+
+#include <hardware/gralloc.h>
+
+#include "gralloc_priv.h"
+#include "exynos_format.h"
+#include "format_convert.h"
+#include "plane_layout.h"
+
+namespace scalar {
+#define GRALLOC_CONVERT_NO_SIMD
+#include "format_convert.cpp"
+#undef GRALLOC_CONVERT_NO_SIMD
+}
+
+#define CHECK(expr) \
+    do { \
+        if (!(expr)) { \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #expr); \
+            return 1; \
+        } \
+    } while (0)
+
+static const int widths[] = { 1, 2, 7, 8, 15, 16, 17, 31, 33, 64, 100, 131 };
+static const int heights[] = { 1, 2, 3, 7, 16 };
+
+/* a 4:2:0 image in one buffer: luma, then chroma, then S10B 2-bit planes */
+struct test_image {
+    std::vector<uint8_t> mem;
+    struct gralloc_yuv_image img;
+};
+
+enum layout { NV12, NV21, PLANAR, P010, P010_VU, S10B };
+
+static void fill_random(std::vector<uint8_t> &v)
+{
+    for (auto &b : v)
+        b = rand() & 0xff;
+}
+
+static void make_image(struct test_image *t, enum layout l, int w, int h, bool random)
+{
+    int cw = (w + 1) / 2, ch = (h + 1) / 2;
+    int bps = (l == P010 || l == P010_VU) ? 2 : 1;
+    int y_stride = w * bps + 13;
+    int c_stride = (l == PLANAR) ? cw + 5 : cw * 2 * bps + 9;
+    int b2_stride = (w + 3) / 4 + 3;
+    size_t y_size = (size_t)y_stride * h;
+    size_t c_size = (size_t)c_stride * ch;
+
+    t->mem.assign(y_size + c_size * 2 + (size_t)b2_stride * (h + ch), 0x5a);
+    if (random)
+        fill_random(t->mem);
+
+    struct gralloc_yuv_image *img = &t->img;
+    uint8_t *c = t->mem.data() + y_size;
+
+    memset(img, 0, sizeof(*img));
+    img->width = w;
+    img->height = h;
+    img->y = t->mem.data();
+    img->y_stride = y_stride;
+    img->c_stride = c_stride;
+    switch (l) {
+    case NV12:
+    case S10B:
+        img->cb = c;
+        img->cr = c + 1;
+        img->c_step = 2;
+        break;
+    case NV21:
+        img->cr = c;
+        img->cb = c + 1;
+        img->c_step = 2;
+        break;
+    case PLANAR:
+        img->cb = c;
+        img->cr = c + c_size;
+        img->c_step = 1;
+        break;
+    case P010:
+        img->cb = c;
+        img->cr = c + 2;
+        img->c_step = 4;
+        break;
+    case P010_VU:
+        img->cr = c;
+        img->cb = c + 2;
+        img->c_step = 4;
+        break;
+    }
+    if (l == S10B) {
+        img->y2b = c + c_size * 2;
+        img->y2b_stride = b2_stride;
+        img->c2b = img->y2b + (size_t)b2_stride * h;
+        img->c2b_stride = b2_stride;
+    }
+}
+
+static int test_nv_to_rgba(int w, int h)
+{
+    for (int l = NV12; l <= NV21; l++) {
+        for (int full = 0; full < 2; full++) {
+            struct test_image src;
+            int stride = w * 4 + 20;
+            std::vector<uint8_t> simd(stride * h, 0x5a), plain(stride * h, 0x5a);
+
+            make_image(&src, (enum layout)l, w, h, true);
+            CHECK(gralloc_convert_nv_to_rgba(&src.img, full, simd.data(), stride) == 0);
+            CHECK(scalar::gralloc_convert_nv_to_rgba(&src.img, full, plain.data(), stride) == 0);
+            CHECK(simd == plain);
+        }
+    }
+
+    return 0;
+}
+
+static int test_rgba_to_nv(int w, int h)
+{
+    for (int l = NV12; l <= NV21; l++) {
+        struct test_image simd, plain;
+        int stride = w * 4 + 20;
+        std::vector<uint8_t> rgba(stride * h);
+
+        fill_random(rgba);
+        make_image(&simd, (enum layout)l, w, h, false);
+        make_image(&plain, (enum layout)l, w, h, false);
+        CHECK(gralloc_convert_rgba_to_nv(rgba.data(), stride, &simd.img) == 0);
+        CHECK(scalar::gralloc_convert_rgba_to_nv(rgba.data(), stride, &plain.img) == 0);
+        CHECK(simd.mem == plain.mem);
+    }
+
+    return 0;
+}
+
+static int test_planar_nv(int w, int h)
+{
+    for (int l = NV12; l <= NV21; l++) {
+        struct test_image planar, simd, plain;
+
+        make_image(&planar, PLANAR, w, h, true);
+        make_image(&simd, (enum layout)l, w, h, false);
+        make_image(&plain, (enum layout)l, w, h, false);
+        CHECK(gralloc_convert_planar_to_nv(&planar.img, &simd.img) == 0);
+        CHECK(scalar::gralloc_convert_planar_to_nv(&planar.img, &plain.img) == 0);
+        CHECK(simd.mem == plain.mem);
+
+        struct test_image nv, simd_p, plain_p;
+
+        make_image(&nv, (enum layout)l, w, h, true);
+        make_image(&simd_p, PLANAR, w, h, false);
+        make_image(&plain_p, PLANAR, w, h, false);
+        CHECK(gralloc_convert_nv_to_planar(&nv.img, &simd_p.img) == 0);
+        CHECK(scalar::gralloc_convert_nv_to_planar(&nv.img, &plain_p.img) == 0);
+        CHECK(simd_p.mem == plain_p.mem);
+    }
+
+    return 0;
+}
+
+static int test_s10b_to_p010(int w, int h)
+{
+    struct test_image src, simd, plain;
+
+    make_image(&src, S10B, w, h, true);
+    make_image(&simd, P010, w, h, false);
+    make_image(&plain, P010, w, h, false);
+    CHECK(gralloc_convert_s10b_to_p010(&src.img, &simd.img) == 0);
+    CHECK(scalar::gralloc_convert_s10b_to_p010(&src.img, &plain.img) == 0);
+    CHECK(simd.mem == plain.mem);
+
+    return 0;
+}
+
+static int test_p010_rgba1010102(int w, int h)
+{
+    for (int l = P010; l <= P010_VU; l++) {
+        struct test_image src;
+        int stride = w * 4 + 20;
+        std::vector<uint8_t> simd(stride * h, 0x5a), plain(stride * h, 0x5a);
+
+        make_image(&src, (enum layout)l, w, h, true);
+        CHECK(gralloc_convert_p010_to_rgba1010102(&src.img, simd.data(), stride) == 0);
+        CHECK(scalar::gralloc_convert_p010_to_rgba1010102(&src.img, plain.data(), stride) == 0);
+        CHECK(simd == plain);
+
+        struct test_image simd_p, plain_p;
+        std::vector<uint8_t> rgba(stride * h);
+
+        fill_random(rgba);
+        make_image(&simd_p, (enum layout)l, w, h, false);
+        make_image(&plain_p, (enum layout)l, w, h, false);
+        CHECK(gralloc_convert_rgba1010102_to_p010(rgba.data(), stride, &simd_p.img) == 0);
+        CHECK(scalar::gralloc_convert_rgba1010102_to_p010(rgba.data(), stride, &plain_p.img) == 0);
+        CHECK(simd_p.mem == plain_p.mem);
+    }
+
+    return 0;
+}
+
+int main(void)
+{
+    int failed = 0;
+
+    srand(1);
+    for (int w : widths) {
+        for (int h : heights) {
+            int f = 0;
+
+            f += test_nv_to_rgba(w, h);
+            f += test_rgba_to_nv(w, h);
+            f += test_planar_nv(w, h);
+            f += test_s10b_to_p010(w, h);
+            f += test_p010_rgba1010102(w, h);
+            if (f)
+                fprintf(stderr, "%dx%d: %d conversions differ\n", w, h, f);
+            failed += f;
+        }
+    }
+
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    return failed ? 1 : 0;
+}
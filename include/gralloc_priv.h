@@ -39,6 +39,16 @@
 #define GRALLOC_USAGE_DAYDREAM_SINGLE_BUFFER_MODE   GRALLOC_USAGE_PRIVATE_2
 #define GRALLOC_USAGE_SECURE_CAMERA_RESERVED        GRALLOC_USAGE_PRIVATE_3
 
+/*
+ * Private gralloc_module_t::perform operations
+ *
+ * GRALLOC_MODULE_PERFORM_DUMP_STATS(char *buff, int buff_len)
+ *   writes this process' allocation statistics into buff as one JSON
+ *   object; returns the length it needed, like snprintf. A NULL buff
+ *   with buff_len 0 only returns the length.
+ */
+#define GRALLOC_MODULE_PERFORM_DUMP_STATS           0x10000001
+
 #define AFBC_INFO_SIZE                              (sizeof(int))
 #define AFBC_ENABLE                                 (0xafbc)
 
@@ -56,6 +66,12 @@ struct private_handle_t;
 struct private_module_t {
     gralloc_module_t base;
 
+    enum {
+        // fb0 has room for several screens and can pan between them.
+        // Only set in the process that opened fb0 (non-Treble builds).
+        PAGE_FLIP = 0x00000001
+    };
+
     private_handle_t* framebuffer;
     uint32_t flags;
     uint32_t numBuffers;
@@ -92,6 +108,12 @@ struct private_handle_t {
         PRIV_FLAGS_USES_ION    = 0x00000020
     };
 
+    /* layout bits, set by gralloc_alloc_yuv and marshalled with the handle */
+    enum {
+        LAYOUT_PACKED_PLANES      = 0x00000001,  // GRALLOC_SINGLE_ALLOC_YUV
+        LAYOUT_EMBEDDED_METADATA  = 0x00000002   // GRALLOC_EMBEDDED_PRIV
+    };
+
     // file-descriptors
     int     fd;
     int     fd1;
@@ -118,7 +140,7 @@ struct private_handle_t {
     int     is_compressible; // 54
 
     // FIXME: the attributes below should be out-of-line
-    int __unknown3; // 58
+    int     layout; // 58   LAYOUT_* bits, how the planes are laid out in the fds
     int __unknown4; // 5c
     int __unknown5; // 60
     /* not sure about these three */
@@ -136,7 +158,8 @@ struct private_handle_t {
     private_handle_t(int fd, int size, int flags) :
         fd(fd), fd1(-1), fd2(-1), magic(sMagic), flags(flags), size(size), size1(0), size2(0),
         offset(0), format(0), internal_format(0), frameworkFormat(0), width(0), height(0), stride(0), vstride(0),
-        is_compressible(0), compressed_out(0), prefer_compression(PREFER_COMPRESSION_NO_CHANGE),
+        is_compressible(0), layout(0), compressed_out(0), prefer_compression(PREFER_COMPRESSION_NO_CHANGE),
+        lock_usage(0), lock_offset(0), lock_len(0),
         dssRatio(0), handle(0), handle1(0), handle2(0), base(0), base1(0), base2(0)
 
     {
@@ -149,7 +172,8 @@ struct private_handle_t {
                     int h, int format, uint64_t internal_format, int frameworkFormat, int stride, int vstride, int is_compressible) :
         fd(fd), fd1(-1), fd2(-1), magic(sMagic), flags(flags), size(size), size1(0), size2(0),
         offset(0), format(format), internal_format(internal_format), frameworkFormat(frameworkFormat), width(w), height(h), stride(stride), vstride(vstride),
-        is_compressible(is_compressible), compressed_out(0), prefer_compression(PREFER_COMPRESSION_NO_CHANGE),
+        is_compressible(is_compressible), layout(0), compressed_out(0), prefer_compression(PREFER_COMPRESSION_NO_CHANGE),
+        lock_usage(0), lock_offset(0), lock_len(0),
         dssRatio(0), handle(0), handle1(0), handle2(0), base(0), base1(0), base2(0)
 
     {
@@ -162,7 +186,8 @@ struct private_handle_t {
                     int h, int format, uint64_t internal_format, int frameworkFormat, int stride, int vstride, int is_compressible) :
         fd(fd), fd1(fd1), fd2(-1), magic(sMagic), flags(flags), size(size), size1(size1), size2(0),
         offset(0), format(format), internal_format(internal_format), frameworkFormat(frameworkFormat), width(w), height(h), stride(stride), vstride(vstride),
-        is_compressible(is_compressible), compressed_out(0), prefer_compression(PREFER_COMPRESSION_NO_CHANGE),
+        is_compressible(is_compressible), layout(0), compressed_out(0), prefer_compression(PREFER_COMPRESSION_NO_CHANGE),
+        lock_usage(0), lock_offset(0), lock_len(0),
         dssRatio(0), handle(0), handle1(0), handle2(0), base(0), base1(0), base2(0)
 
     {
@@ -175,7 +200,8 @@ struct private_handle_t {
                     int h, int format, uint64_t internal_format, int frameworkFormat, int stride, int vstride, int is_compressible) :
         fd(fd), fd1(fd1), fd2(fd2), magic(sMagic), flags(flags), size(size), size1(size1), size2(size2),
         offset(0), format(format), internal_format(internal_format), frameworkFormat(frameworkFormat), width(w), height(h), stride(stride), vstride(vstride),
-        is_compressible(is_compressible), compressed_out(0), prefer_compression(PREFER_COMPRESSION_NO_CHANGE),
+        is_compressible(is_compressible), layout(0), compressed_out(0), prefer_compression(PREFER_COMPRESSION_NO_CHANGE),
+        lock_usage(0), lock_offset(0), lock_len(0),
         dssRatio(0), handle(0), handle1(0), handle2(0), base(0), base1(0), base2(0)
 
     {
@@ -207,10 +233,67 @@ struct private_handle_t {
         return NULL;
     }
 
+    /*
+     * Multi-plane formats allocated as one dma-buf (LAYOUT_PACKED_PLANES)
+     * have no fd1/fd2 but keep the size1 (and size2) of their chroma or
+     * metadata planes, which follow the luma in fd, each on its own page.
+     * Returns the number of planes in fd then, 0 for the per-plane layout.
+     * Worked out from the marshalled fields, so it holds in every process.
+     */
+    int getPackedPlanes() const {
+        if (!(layout & LAYOUT_PACKED_PLANES))
+            return 0;
+        return (size2 > 0) ? 3 : 2;
+    }
+
+    /*
+     * PRIV/S10B metadata kept in the tail of the luma buffer
+     * (LAYOUT_EMBEDDED_METADATA): the last size2 bytes of fd. Returns the
+     * byte offset of it in fd, 0 if it has its own buffer in fd2 or is
+     * plane 2 of a packed buffer.
+     */
+    int getEmbeddedMetadataOffset() const {
+        if (!(layout & LAYOUT_EMBEDDED_METADATA))
+            return 0;
+        return size - size2;
+    }
+
+    /* fd and byte offset of a plane, for both packed and per-plane layouts */
+    int getPlaneFd(int plane) const {
+        if (getPackedPlanes() || plane == 0)
+            return fd;
+        if (plane == 2 && getEmbeddedMetadataOffset())
+            return fd;
+        return (plane == 1) ? fd1 : fd2;
+    }
+
+    int getPlaneOffset(int plane) const {
+        if (plane == 2 && getEmbeddedMetadataOffset())
+            return getEmbeddedMetadataOffset();
+
+        int planes = getPackedPlanes();
+        if (!planes || plane == 0)
+            return 0;
+        if (planes == 2)
+            return size - size1;
+        if (plane == 2)
+            return size - size2;
+        return size - size2 - ((size1 + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+    }
+
+    /* PRIV/S10B codec metadata, size2 bytes at this fd and offset */
+    int getMetadataFd() const {
+        return getPlaneFd(2);
+    }
+
+    int getMetadataOffset() const {
+        return getPlaneOffset(2);
+    }
+
     /* not sure about these four */
-    int     lock_usage; // 70
-    int     lock_offset; // 74
-    int     lock_len; // 78
+    int     lock_usage; // 70   SW access bits of the current lock
+    int     lock_offset; // 74  first locked row
+    int     lock_len; // 78     number of locked rows
     int     dssRatio; // 7c
 
     ion_user_handle_t handle; // 80
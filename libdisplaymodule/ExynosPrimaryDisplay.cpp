@@ -1,8 +1,14 @@
+#include <inttypes.h>
+#include <sync/sync.h>
+
 #include "ExynosPrimaryDisplay.h"
 #include "ExynosHWCModule.h"
 #include "ExynosHWCUtils.h"
 #include "ExynosMPPModule.h"
 
+/* panel column/page address setup and DECON reconfiguration, in full lines */
+#define WINUPDATE_OVERHEAD_LINES 32
+
 #define DISPLAY_LOGD(msg, ...) ALOGD("[%s] " msg, mDisplayName.string(), ##__VA_ARGS__)
 #define DISPLAY_LOGV(msg, ...) ALOGV("[%s] " msg, mDisplayName.string(), ##__VA_ARGS__)
 #define DISPLAY_LOGI(msg, ...) ALOGI("[%s] " msg, mDisplayName.string(), ##__VA_ARGS__)
@@ -10,12 +16,164 @@
 #define DISPLAY_LOGE(msg, ...) ALOGE("[%s] " msg, mDisplayName.string(), ##__VA_ARGS__)
 
 ExynosPrimaryDisplay::ExynosPrimaryDisplay(int numGSCs, struct exynos5_hwc_composer_device_1_t *pdev) :
-    ExynosOverlayDisplay(numGSCs, pdev)
+    ExynosOverlayDisplay(numGSCs, pdev),
+    prevfbTargetIdma(IDMA_G0),
+    mWinUpdateProp(NULL),
+    mWinUpdatePropSerial(0),
+    mWinUpdateAreaSerial(0),
+    mWinUpdateEnabled(false),
+    mFbDamageFrames(0),
+    mLastFrameLayers(0),
+    mLastFrameValid(false),
+    mLastRetireFenceFd(-1)
 {
 }
 
 ExynosPrimaryDisplay::~ExynosPrimaryDisplay()
 {
+    if (mLastRetireFenceFd >= 0)
+        close(mLastRetireFenceFd);
+}
+
+/*
+ * Identifies an acquire fence by its timeline and the time its points
+ * signalled: the fence of a newer buffer on the same timeline signals
+ * later. Returns false for no fence, or one still pending, since either
+ * may come with new content.
+ */
+static bool getFenceIdentity(int fenceFd, struct static_layer_sig &sig)
+{
+    struct sync_fence_info_data *info;
+    struct sync_pt_info *pt = NULL;
+    bool signalled = true;
+
+    if (fenceFd < 0)
+        return false;
+
+    info = sync_fence_info(fenceFd);
+    if (!info)
+        return false;
+
+    while ((pt = sync_pt_info(info, pt)) != NULL) {
+        if (pt->status != 1) {
+            signalled = false;
+            break;
+        }
+        if (!sig.fencePts)
+            strncpy(sig.fenceTimeline, pt->obj_name, sizeof(sig.fenceTimeline) - 1);
+        sig.fencePts++;
+        if (pt->timestamp_ns > sig.fenceTimestamp)
+            sig.fenceTimestamp = pt->timestamp_ns;
+    }
+    sync_fence_info_free(info);
+
+    return signalled && sig.fencePts;
+}
+
+/*
+ * A frame is static when every layer shows the same buffer as in the last
+ * frame posted, with the same composition, crop, position, transform,
+ * blending and alpha, and every layer DECON reads carries the very same
+ * signalled acquire fence as last time. SurfaceFlinger hands an unchanged
+ * overlay layer a dup of its buffer's fence every frame, so that fence
+ * stays the same until a new buffer or new content arrives. A layer with
+ * no fence proves nothing (a shared buffer can change under the same
+ * handle without one) and always posts.
+ *
+ * A new handle is never static, even with empty damage: DECON has to move
+ * to it before SurfaceFlinger frees the old buffer. Unblank and mode
+ * changes come with HWC_GEOMETRY_CHANGED.
+ *
+ * Fills sig for the frame either way.
+ */
+bool ExynosPrimaryDisplay::isStaticFrame(hwc_display_contents_1_t *contents,
+        struct static_layer_sig *sig)
+{
+    bool fresh = false;
+
+    if (!contents || contents->numHwLayers > MAX_STATIC_LAYERS)
+        return false;
+
+    memset(sig, 0, sizeof(*sig) * contents->numHwLayers);
+    for (size_t i = 0; i < contents->numHwLayers; i++) {
+        hwc_layer_1_t &layer = contents->hwLayers[i];
+
+        sig[i].handle = layer.handle;
+        sig[i].compositionType = layer.compositionType;
+        sig[i].flags = layer.flags;
+        sig[i].transform = layer.transform;
+        sig[i].blending = layer.blending;
+        sig[i].planeAlpha = layer.planeAlpha;
+        sig[i].sourceCropf = layer.sourceCropf;
+        sig[i].displayFrame = layer.displayFrame;
+
+        /* GLES layers only reach DECON through the FB target */
+        if ((layer.compositionType == HWC_FRAMEBUFFER) ||
+            (layer.compositionType == HWC_FRAMEBUFFER_TARGET && !mFbNeeded))
+            continue;
+        if (!getFenceIdentity(layer.acquireFenceFd, sig[i]))
+            fresh = true;
+    }
+
+    return mLastFrameValid && !fresh &&
+        !(contents->flags & HWC_GEOMETRY_CHANGED) &&
+        contents->numHwLayers == mLastFrameLayers &&
+        !memcmp(sig, mLastFrameSig, sizeof(*sig) * contents->numHwLayers);
+}
+
+int ExynosPrimaryDisplay::set(hwc_display_contents_1_t *contents)
+{
+    struct static_layer_sig sig[MAX_STATIC_LAYERS];
+
+    /* nothing to post; whatever is posted next can't be the last frame again */
+    if (!contents) {
+        mLastFrameValid = false;
+        mFbDamageFrames = 0;
+        return 0;
+    }
+
+    bool cacheable = contents->numHwLayers <= MAX_STATIC_LAYERS;
+
+    /*
+     * Nothing changed on screen: skip the MPPs and S3CFB_WIN_CONFIG and hand
+     * back the last frame's retire fence. The buffers stay on screen, so
+     * their release fences from that frame still stand. The acquire fences
+     * are ours to close, as the base set() would have.
+     */
+    if (isStaticFrame(contents, sig)) {
+        for (size_t i = 0; i < contents->numHwLayers; i++) {
+            hwc_layer_1_t &layer = contents->hwLayers[i];
+
+            if (layer.acquireFenceFd >= 0) {
+                close(layer.acquireFenceFd);
+                layer.acquireFenceFd = -1;
+            }
+            layer.releaseFenceFd = -1;
+        }
+        contents->retireFenceFd = -1;
+        if (mLastRetireFenceFd >= 0)
+            contents->retireFenceFd = dup(mLastRetireFenceFd);
+        return 0;
+    }
+
+    int ret = ExynosOverlayDisplay::set(contents);
+
+    recordFbTargetDamage(contents);
+
+    if (mLastRetireFenceFd >= 0) {
+        close(mLastRetireFenceFd);
+        mLastRetireFenceFd = -1;
+    }
+    if (contents->retireFenceFd >= 0)
+        mLastRetireFenceFd = dup(contents->retireFenceFd);
+
+    mLastFrameValid = cacheable && ret == 0;
+    if (mLastFrameValid) {
+        memcpy(mLastFrameSig, sig, sizeof(sig[0]) * contents->numHwLayers);
+        mLastFrameLayers = contents->numHwLayers;
+    }
+
+    return ret;
 }
 
 int ExynosPrimaryDisplay::getDeconWinMap(int overlayIndex __unused, int totalOverlays __unused)
@@ -49,80 +207,263 @@ bool ExynosPrimaryDisplay::isYuvDmaAvailable(int format, uint32_t dma)
         dma == IDMA_G2);
 }
 
-void ExynosPrimaryDisplay::assignWindows(hwc_display_contents_1_t *contents)
+/* one per hardware window, see assignIdmaChannels() */
+struct idma_layer {
+    size_t index;
+    int format;
+    bool drm;
+    bool skip;
+    bool fbTarget;
+    bool viaMPP;
+    /* displayFrame meets the IDMA alignment for YUV MSC output */
+    bool yuvAligned;
+    uint64_t srcPixels;
+    uint64_t dstPixels;
+    enum decon_idma_type baseDma;
+};
+
+/* compared field by field, earlier fields matter more */
+struct idma_cost {
+    unsigned int unreadable;
+    unsigned int overBandwidth;
+    uint64_t bytes;
+    unsigned int fbMoved;
+    unsigned int changed;
+
+    bool operator<(const idma_cost &o) const {
+        if (unreadable != o.unreadable)
+            return unreadable < o.unreadable;
+        if (overBandwidth != o.overBandwidth)
+            return overBandwidth < o.overBandwidth;
+        if (bytes != o.bytes)
+            return bytes < o.bytes;
+        if (fbMoved != o.fbMoved)
+            return fbMoved < o.fbMoved;
+        return changed < o.changed;
+    }
+};
+
+/* position of an IDMA channel in the FIMD_DMA_CH_* tables */
+static size_t idmaChannelSlot(enum decon_idma_type dma)
 {
-    // call the ExynosDisplay default implementation of assignWindows()
-    ExynosDisplay::assignWindows(contents);
+    switch (dma) {
+    case IDMA_G1:
+        return 1;
+    case IDMA_G2:
+        return 2;
+    default:
+        return 0;
+    }
+}
 
-    // allocate the max bandwidth non-rgb layer to IDMA_G2
-    // consider only non-secure dma case - secure dma is already allocated to IDMA_G2
+/* bytes DECON reads for a frame of the layer through the given channel */
+uint64_t ExynosPrimaryDisplay::idmaLayerBytes(const struct idma_layer &l,
+        enum decon_idma_type dma)
+{
+    if (l.skip)
+        return 0;
+
+    if (l.viaMPP) {
+        /* the MSC writes a displayFrame sized buffer, see postMPPM2M() */
+        unsigned int bpp;
+        if (isFormatRgb(l.format))
+            bpp = formatToBpp(l.format);
+        else if (isYuvDmaAvailable(l.format, dma) && l.yuvAligned)
+            bpp = formatToBpp(l.format);
+        else
+            bpp = formatToBpp(mExternalMPPDstFormat);
+        return l.dstPixels * bpp / 8;
+    }
 
-    bool videoLayerFound = 0, curDmaYuvFound = 0, hasDRMlayer = 0;
-    uint32_t videoLayerIndex = 0, curDmaYuvIndex = 0;
-    uint32_t mTemp = 0, bandWidth = 0;
-    int fbLayerIndex = -1;
+    return l.srcPixels * formatToBpp(l.format) / 8;
+}
 
-    for (size_t i = 0; i < contents->numHwLayers; i++) {
+void ExynosPrimaryDisplay::idmaScore(const struct idma_layer *layers, size_t n,
+        const enum decon_idma_type *dmas, struct idma_cost &cost)
+{
+    memset(&cost, 0, sizeof(cost));
+
+#ifdef FIMD_BW_OVERLAP_CHECK
+    /*
+     * Only the bandwidth limit is checked. Every candidate puts one window
+     * on each channel, so the overlap count limit (at least 1) always holds.
+     */
+    uint32_t maxBw[MAX_NUM_FIMD_DMA_CH];
+    uint32_t maxOverlap[MAX_NUM_FIMD_DMA_CH];
+    fimd_bw_overlap_limits_init(mXres, mYres, maxBw, maxOverlap);
+#endif
+
+    for (size_t i = 0; i < n; i++) {
+        const struct idma_layer &l = layers[i];
+        uint64_t bytes = idmaLayerBytes(l, dmas[i]);
+
+        if (!l.skip) {
+            if (l.drm && dmas[i] != IDMA_G2)
+                cost.unreadable++;
+            else if (!l.viaMPP && !isFormatRgb(l.format) &&
+                    !isYuvDmaAvailable(l.format, dmas[i]))
+                cost.unreadable++;
+        }
+
+#ifdef FIMD_BW_OVERLAP_CHECK
+        /* the limits are in 32bpp pixels per frame */
+        size_t slot = idmaChannelSlot(dmas[i]);
+        if (slot < MAX_NUM_FIMD_DMA_CH && bytes / 4 > maxBw[slot])
+            cost.overBandwidth++;
+#endif
+
+        cost.bytes += bytes;
+        if (l.fbTarget && dmas[i] != prevfbTargetIdma)
+            cost.fbMoved++;
+        if (dmas[i] != l.baseDma)
+            cost.changed++;
+    }
+}
+
+/*
+ * Picks the IDMA channel of every window. ExynosDisplay::assignWindows()
+ * has already placed the layers in windows and given them MPPs; the
+ * channel still decides what can be read directly, since only IDMA_G2
+ * reads YUV and DRM buffers, and how much, since the MSC writes YUV
+ * instead of RGB for layers that land on G2.
+ *
+ * Every injective mapping of the windowed layers onto the channels the
+ * base assignment used plus IDMA_G2 is scored, at most 4 * 3 * 2 of them,
+ * and the cheapest kept (see idma_cost). Ties keep the first candidate in
+ * enumeration order, so the result only depends on the layer list and the
+ * FB target's previous channel.
+ *
+ * Only the channels are searched. Which layers get a window or an MPP, and
+ * which fall back to GLES, stays as assignWindows() left it, so GLES
+ * composition is never weighed against an overlay here. Rotation is not
+ * scored: DECON can't rotate, so rotated layers go through the MSC, which
+ * writes them upright at displayFrame size on any channel.
+ */
+void ExynosPrimaryDisplay::assignIdmaChannels(hwc_display_contents_1_t *contents)
+{
+    struct idma_layer layers[NUM_HW_WINDOWS];
+    enum decon_idma_type pool[NUM_HW_WINDOWS + 1];
+    size_t n = 0, poolSize = 0;
+
+    for (size_t i = 0; i < contents->numHwLayers && n < NUM_HW_WINDOWS; i++) {
         hwc_layer_1_t &layer = contents->hwLayers[i];
 
         if (!layer.handle)
             continue;
+        if (layer.compositionType != HWC_OVERLAY &&
+                !(layer.compositionType == HWC_FRAMEBUFFER_TARGET &&
+                  mFbNeeded && mFbWindow < NUM_HW_WINDOWS))
+            continue;
+        if (mLayerInfos[i]->mDmaType < IDMA_G0 || mLayerInfos[i]->mDmaType >= IDMA_MAX)
+            continue;
 
         private_handle_t *handle = private_handle_t::dynamicCast(layer.handle);
+        struct idma_layer &l = layers[n++];
+
+        l.index = i;
+        l.format = handle->format;
+        l.drm = getDrmMode(handle->flags) == SECURE_DRM;
+        l.skip = !!(layer.flags & HWC_SKIP_RENDERING);
+        l.fbTarget = layer.compositionType == HWC_FRAMEBUFFER_TARGET;
+        l.viaMPP = mLayerInfos[i]->mExternalMPP != NULL;
+        l.yuvAligned = WIDTH(layer.displayFrame) % getIDMAWidthAlign(handle->format) == 0 &&
+            HEIGHT(layer.displayFrame) % getIDMAHeightAlign(handle->format) == 0;
+        l.srcPixels = (uint64_t)(layer.sourceCropf.right - layer.sourceCropf.left) *
+            (uint64_t)(layer.sourceCropf.bottom - layer.sourceCropf.top);
+        l.dstPixels = (uint64_t)WIDTH(layer.displayFrame) * HEIGHT(layer.displayFrame);
+        l.baseDma = (enum decon_idma_type)mLayerInfos[i]->mDmaType;
+
+        bool pooled = false;
+        for (size_t p = 0; p < poolSize; p++)
+            pooled |= pool[p] == l.baseDma;
+        if (!pooled)
+            pool[poolSize++] = l.baseDma;
+    }
 
-        if (layer.compositionType == HWC_FRAMEBUFFER_TARGET)
-            fbLayerIndex = i;
-
-        // If there is DRM layer available, it has to go to IDMA_G2 channel.
-        if (layer.compositionType == HWC_OVERLAY &&
-                getDrmMode(handle->flags) == SECURE_DRM &&
-                !(layer.flags & HWC_SKIP_RENDERING)) {
-            hasDRMlayer = 1;
-            videoLayerFound = 1;
-            videoLayerIndex = i;
+    bool hasG2 = false;
+    for (size_t p = 0; p < poolSize; p++)
+        hasG2 |= pool[p] == IDMA_G2;
+    if (!hasG2)
+        pool[poolSize++] = IDMA_G2;
+
+    enum decon_idma_type best[NUM_HW_WINDOWS];
+    enum decon_idma_type cand[NUM_HW_WINDOWS];
+    struct idma_cost bestCost, cost;
+    size_t pick[NUM_HW_WINDOWS];
+    size_t total = 1;
+    bool found = false;
+
+    for (size_t i = 0; i < n; i++)
+        total *= poolSize;
+
+    /* count through pool^n and skip the tuples that reuse a channel */
+    for (size_t t = 0; t < total; t++) {
+        size_t rest = t;
+        bool injective = true;
+
+        for (size_t i = 0; i < n; i++) {
+            pick[i] = rest % poolSize;
+            rest /= poolSize;
+            for (size_t j = 0; j < i; j++)
+                injective &= pick[j] != pick[i];
+            cand[i] = pool[pick[i]];
         }
+        if (!injective)
+            continue;
 
-        // If no DRM layer, find non-rgb overlay layer which can be supported by IDMA_G2.
-        if ((layer.compositionType == HWC_OVERLAY) &&
-                    isYuvDmaAvailable(handle->format, IDMA_G2) &&
-                    !(layer.flags & HWC_SKIP_RENDERING) &&
-                    !hasDRMlayer) {
-
-            mTemp = (layer.sourceCropf.right - layer.sourceCropf.left) *
-                (layer.sourceCropf.bottom - layer.sourceCropf.top);
-            if (mTemp > bandWidth) {
-                bandWidth = mTemp;
-                videoLayerFound = 1;
-                videoLayerIndex = i;
-            }
+        idmaScore(layers, n, cand, cost);
+        if (!found || cost < bestCost) {
+            memcpy(best, cand, sizeof(cand[0]) * n);
+            bestCost = cost;
+            found = true;
         }
+    }
 
-        if (((layer.compositionType == HWC_OVERLAY) ||
-            (layer.compositionType == HWC_FRAMEBUFFER_TARGET)) &&
-            (!curDmaYuvFound) &&
-            (mLayerInfos[i]->mDmaType == IDMA_G2)) {
-            curDmaYuvFound = 1;
-            curDmaYuvIndex = i;
+    if (!found)
+        return;
+
+    bool fbAssigned = false;
+    for (size_t i = 0; i < n; i++) {
+        if (best[i] != layers[i].baseDma)
+            HLOGD("[IDMA] layer %zu: %d -> %d", layers[i].index, layers[i].baseDma, best[i]);
+        mLayerInfos[layers[i].index]->mDmaType = best[i];
+        if (layers[i].fbTarget) {
+            prevfbTargetIdma = best[i];
+            fbAssigned = true;
         }
     }
 
-    if (curDmaYuvFound && videoLayerFound) {
-        mTemp = mLayerInfos[videoLayerIndex]->mDmaType;
-        mLayerInfos[videoLayerIndex]->mDmaType = mLayerInfos[curDmaYuvIndex]->mDmaType;
-        mLayerInfos[curDmaYuvIndex]->mDmaType = mTemp;
-    }
+    if (bestCost.unreadable)
+        DISPLAY_LOGW("%u layer(s) left on a channel that can't read them", bestCost.unreadable);
 
-    if (videoLayerFound && !curDmaYuvFound) {
-        if (prevfbTargetIdma == IDMA_G2) {
-            prevfbTargetIdma = (enum decon_idma_type) mLayerInfos[videoLayerIndex]->mDmaType;
-            mLayerInfos[videoLayerIndex]->mDmaType = IDMA_G2;
-            return;
+    /*
+     * A static FB target reuses its last window on prevfbTargetIdma, see
+     * handleStaticLayers(). Keep that channel clear of the other windows.
+     */
+    if (!fbAssigned) {
+        bool taken = false;
+        for (size_t i = 0; i < n; i++)
+            taken |= best[i] == prevfbTargetIdma;
+        for (size_t p = 0; taken && p < poolSize; p++) {
+            bool used = false;
+            for (size_t i = 0; i < n; i++)
+                used |= best[i] == pool[p];
+            if (!used) {
+                prevfbTargetIdma = pool[p];
+                taken = false;
+            }
         }
-        mLayerInfos[videoLayerIndex]->mDmaType = IDMA_G2;
     }
+}
 
-    if (mFbNeeded && mFbWindow < NUM_HW_WINDOWS && fbLayerIndex >= 0)
-       prevfbTargetIdma = (enum decon_idma_type) mLayerInfos[fbLayerIndex]->mDmaType;
+void ExynosPrimaryDisplay::assignWindows(hwc_display_contents_1_t *contents)
+{
+    // call the ExynosDisplay default implementation of assignWindows()
+    ExynosDisplay::assignWindows(contents);
+
+    // then move the windows between IDMA channels where that lets DECON
+    // read more of them, or read them with less bandwidth
+    assignIdmaChannels(contents);
 }
 
 int ExynosPrimaryDisplay::postMPPM2M(hwc_layer_1_t &layer, struct decon_win_config *config, int win_map, int index)
@@ -266,6 +607,170 @@ void ExynosPrimaryDisplay::dump_win_config(struct decon_win_config *config)
     }
 }
 
+bool ExynosPrimaryDisplay::isWindowUpdateEnabled()
+{
+    /* a property that doesn't exist yet can only appear with a new area serial */
+    if (!mWinUpdateProp) {
+        uint32_t areaSerial = __system_property_area_serial();
+        if (areaSerial == mWinUpdateAreaSerial)
+            return mWinUpdateEnabled;
+        mWinUpdateAreaSerial = areaSerial;
+        mWinUpdateProp = __system_property_find("debug.hwc.winupdate");
+        if (!mWinUpdateProp)
+            return mWinUpdateEnabled;
+    }
+
+    uint32_t serial = __system_property_serial(mWinUpdateProp);
+    if (serial != mWinUpdatePropSerial) {
+        char value[PROP_VALUE_MAX];
+
+        mWinUpdatePropSerial = serial;
+        __system_property_read(mWinUpdateProp, NULL, value);
+        mWinUpdateEnabled = !strcmp(value, "1") || !strcmp(value, "true");
+    }
+
+    return mWinUpdateEnabled;
+}
+
+static int deconFormatBpp(enum decon_pixel_format fmt)
+{
+    if (fmt == DECON_PIXEL_FORMAT_RGBA_5551 || fmt == DECON_PIXEL_FORMAT_RGB_565)
+        return 16;
+    else if (fmt == DECON_PIXEL_FORMAT_NV12 || fmt == DECON_PIXEL_FORMAT_NV21 ||
+            fmt == DECON_PIXEL_FORMAT_NV12M || fmt == DECON_PIXEL_FORMAT_NV21M)
+        return 12;
+    else
+        return 32;
+}
+
+/*
+ * Screen area the GLES composed layers changed since the last frame.
+ * Returns false when a layer's damage is unknown or can't be mapped to
+ * the screen, or nothing reports any.
+ */
+bool ExynosPrimaryDisplay::getGlesDamage(hwc_display_contents_1_t *contents, hwc_rect &damage)
+{
+    hwc_rect total = {this->mXres, this->mYres, 0, 0};
+    bool damaged = false;
+
+    for (size_t i = 0; i < contents->numHwLayers; i++) {
+        hwc_layer_1_t &layer = contents->hwLayers[i];
+        hwc_rect layerDamage = {0, 0, 0, 0};
+
+        if (layer.compositionType != HWC_FRAMEBUFFER)
+            continue;
+        if ((layer.flags & HWC_SKIP_LAYER) || layer.surfaceDamage.numRects == 0)
+            return false;
+
+        getLayerRegion(layer, layerDamage, eDamageRegion);
+        /* a single empty rect: unchanged */
+        if (!layerDamage.left && !layerDamage.top && !layerDamage.right && !layerDamage.bottom)
+            continue;
+        if (isScaled(layer) || isRotated(layer))
+            return false;
+
+        hwc_rect screenRect;
+        screenRect.left   = layer.displayFrame.left - (int32_t)layer.sourceCropf.left + layerDamage.left;
+        screenRect.right  = layer.displayFrame.left - (int32_t)layer.sourceCropf.left + layerDamage.right;
+        screenRect.top    = layer.displayFrame.top  - (int32_t)layer.sourceCropf.top  + layerDamage.top;
+        screenRect.bottom = layer.displayFrame.top  - (int32_t)layer.sourceCropf.top  + layerDamage.bottom;
+        screenRect = intersection(screenRect, layer.displayFrame);
+        if (WIDTH(screenRect) <= 0 || HEIGHT(screenRect) <= 0)
+            continue;
+
+        total = expand(total, screenRect);
+        damaged = true;
+    }
+
+    if (!damaged)
+        return false;
+
+    damage = total;
+    return true;
+}
+
+/*
+ * Screen area where this frame's FB target differs from what its buffer
+ * held when it was last posted. SurfaceFlinger cycles through several FB
+ * target buffers, so that is the GLES damage of every frame since then,
+ * this one included. Returns false when the buffer isn't among the last
+ * FB_DAMAGE_HISTORY frames or one of those frames' damage is unknown;
+ * the whole FB target window is updated then.
+ */
+bool ExynosPrimaryDisplay::getFbTargetDamage(hwc_display_contents_1_t *contents, hwc_rect &damage)
+{
+    buffer_handle_t handle = NULL;
+    hwc_rect total;
+
+    for (size_t i = 0; i < contents->numHwLayers; i++) {
+        if (contents->hwLayers[i].compositionType == HWC_FRAMEBUFFER_TARGET)
+            handle = contents->hwLayers[i].handle;
+    }
+    if (!handle || !getGlesDamage(contents, total))
+        return false;
+
+    for (size_t age = 0; age < mFbDamageFrames; age++) {
+        const struct fb_damage_frame &frame = mFbDamage[age];
+
+        if (frame.handle == handle) {
+            damage = total;
+            return true;
+        }
+        if (!frame.valid)
+            return false;
+        total = expand(total, frame.damage);
+    }
+
+    return false;
+}
+
+/* keeps this frame's FB target damage for getFbTargetDamage() in later frames */
+void ExynosPrimaryDisplay::recordFbTargetDamage(hwc_display_contents_1_t *contents)
+{
+    struct fb_damage_frame frame = {NULL, false, {0, 0, 0, 0}};
+
+    for (size_t i = 0; i < contents->numHwLayers; i++) {
+        if (contents->hwLayers[i].compositionType == HWC_FRAMEBUFFER_TARGET)
+            frame.handle = contents->hwLayers[i].handle;
+    }
+    /* after a geometry change the layers' damage doesn't cover what moved */
+    if (frame.handle && mFbNeeded && !(contents->flags & HWC_GEOMETRY_CHANGED))
+        frame.valid = getGlesDamage(contents, frame.damage);
+
+    if (mFbDamageFrames < FB_DAMAGE_HISTORY)
+        mFbDamageFrames++;
+    memmove(&mFbDamage[1], &mFbDamage[0], sizeof(mFbDamage[0]) * (mFbDamageFrames - 1));
+    mFbDamage[0] = frame;
+}
+
+/*
+ * Rough bytes moved for one frame limited to rect: DECON reads each buffer
+ * window where it overlaps rect, and the DSI link carries rect to the panel
+ * at 24bpp.
+ */
+uint64_t ExynosPrimaryDisplay::windowUpdateCost(struct decon_win_config *config, const hwc_rect &rect)
+{
+    uint64_t bytes = (uint64_t)WIDTH(rect) * HEIGHT(rect) * 3;
+
+    for (size_t w = 0; w < NUM_HW_WINDOWS; w++) {
+        if (config[w].state != config[w].DECON_WIN_STATE_BUFFER)
+            continue;
+
+        hwc_rect winRect;
+        winRect.left   = config[w].dst.x;
+        winRect.right  = config[w].dst.x + config[w].dst.w;
+        winRect.top    = config[w].dst.y;
+        winRect.bottom = config[w].dst.y + config[w].dst.h;
+
+        hwc_rect read = intersection(winRect, rect);
+        if (WIDTH(read) <= 0 || HEIGHT(read) <= 0)
+            continue;
+        bytes += (uint64_t)WIDTH(read) * HEIGHT(read) * deconFormatBpp(config[w].format) / 8;
+    }
+
+    return bytes;
+}
+
 int ExynosPrimaryDisplay::handleWindowUpdate(hwc_display_contents_1_t __unused *contents,
     struct decon_win_config __unused *config)
 {
@@ -280,10 +785,7 @@ int ExynosPrimaryDisplay::handleWindowUpdate(hwc_display_contents_1_t __unused *
     int alignAdjustment = 0;
     int intersectionWidth = 0;
 
-    char value[PROPERTY_VALUE_MAX];
-    property_get("debug.hwc.winupdate", value, NULL);
-
-    if (!(!strcmp(value, "1") || !strcmp(value, "true")))
+    if (!isWindowUpdateEnabled())
         return -eWindowUpdateDisabled;
 
     if (DECON_WIN_UPDATE_IDX < 0)
@@ -330,6 +832,13 @@ int ExynosPrimaryDisplay::handleWindowUpdate(hwc_display_contents_1_t __unused *
                         currentRect.top    = config[windowIndex].dst.y - (int32_t)layer.sourceCropf.top  + damageRect.top;
                         currentRect.bottom = config[windowIndex].dst.y - (int32_t)layer.sourceCropf.top  + damageRect.bottom;
 
+                    } else if (layer.compositionType == HWC_FRAMEBUFFER_TARGET) {
+                        hwc_rect fbDamage;
+                        if (getFbTargetDamage(contents, fbDamage)) {
+                            HLOGD("[WIN_UPDATE][fbTarget] GLES damage (%4d, %4d) - (%4d, %4d)",
+                                    fbDamage.left, fbDamage.top, fbDamage.right, fbDamage.bottom);
+                            currentRect = intersection(currentRect, fbDamage);
+                        }
                     }
                 }
 
@@ -357,9 +866,6 @@ int ExynosPrimaryDisplay::handleWindowUpdate(hwc_display_contents_1_t __unused *
             updateRect.top = updateRect.bottom - WINUPDATE_MIN_HEIGHT;
     }
 
-    if ((100 * (WIDTH(updateRect) * HEIGHT(updateRect)) / (this->mXres * this->mYres)) > WINUPDATE_THRESHOLD)
-        return -eWindowUpdateOverThreshold;
-
     alignAdjustment = max(WINUPDATE_X_ALIGNMENT, WINUPDATE_W_ALIGNMENT);
 
     while (1) {
@@ -372,15 +878,7 @@ int ExynosPrimaryDisplay::handleWindowUpdate(hwc_display_contents_1_t __unused *
                 continue;
             int32_t windowIndex = mLayerInfos[i]->mWindowIndex;
             if (config[windowIndex].state != config[windowIndex].DECON_WIN_STATE_DISABLED) {
-                enum decon_pixel_format fmt = config[windowIndex].format;
-
-                if (fmt == DECON_PIXEL_FORMAT_RGBA_5551 || fmt == DECON_PIXEL_FORMAT_RGB_565 )
-                        bitsPerPixel = 16;
-                else if (fmt == DECON_PIXEL_FORMAT_NV12 || fmt == DECON_PIXEL_FORMAT_NV21 ||
-                    fmt == DECON_PIXEL_FORMAT_NV12M || fmt == DECON_PIXEL_FORMAT_NV21M)
-                        bitsPerPixel = 12;
-                else
-                        bitsPerPixel = 32;
+                bitsPerPixel = deconFormatBpp(config[windowIndex].format);
 
                 currentRect.left   = config[windowIndex].dst.x;
                 currentRect.right  = config[windowIndex].dst.x + config[windowIndex].dst.w;
@@ -412,6 +910,24 @@ int ExynosPrimaryDisplay::handleWindowUpdate(hwc_display_contents_1_t __unused *
         }
     }
 
+    /*
+     * One merged rectangle is all DECON takes, so far apart damage can
+     * cover most of the screen. Weigh what the final, aligned rectangle
+     * moves, plus the panel's address setup and DECON's reconfiguration
+     * counted as WINUPDATE_OVERHEAD_LINES full lines, against a full update.
+     */
+    hwc_rect fullRect = {0, 0, this->mXres, this->mYres};
+    uint64_t partialCost = windowUpdateCost(config, updateRect) +
+        (uint64_t)WINUPDATE_OVERHEAD_LINES * this->mXres * 3;
+    uint64_t fullCost = windowUpdateCost(config, fullRect);
+
+    if (100 * partialCost > fullCost * WINUPDATE_THRESHOLD) {
+        HLOGD("[WIN_UPDATE] (%4d, %4d) - (%4d, %4d) costs %" PRIu64 " of %" PRIu64 " bytes, full update",
+                updateRect.left, updateRect.top, updateRect.right, updateRect.bottom,
+                partialCost, fullCost);
+        return -eWindowUpdateOverThreshold;
+    }
+
     config[winUpdateInfoIdx].state = config[winUpdateInfoIdx].DECON_WIN_STATE_UPDATE;
     config[winUpdateInfoIdx].dst.x = updateRect.left;
     config[winUpdateInfoIdx].dst.y = updateRect.top;
@@ -423,7 +939,7 @@ int ExynosPrimaryDisplay::handleWindowUpdate(hwc_display_contents_1_t __unused *
 
     /* Disable block mode if window update region is not full screen */
     if ((config[winUpdateInfoIdx].dst.x != 0) || (config[winUpdateInfoIdx].dst.y != 0) ||
-        (config[winUpdateInfoIdx].dst.w != (uint32_t)mXres) || (config[winUpdateInfoIdx].dst.h != (uint32_t)mXres)) {
+        (config[winUpdateInfoIdx].dst.w != (uint32_t)mXres) || (config[winUpdateInfoIdx].dst.h != (uint32_t)mYres)) {
         for (size_t i = 0; i < NUM_HW_WINDOWS; i++) {
             memset(&config[i].transparent_area, 0, sizeof(config[i].transparent_area));
             //memset(&config[i].covered_opaque_area, 0, sizeof(config[i].covered_opaque_area));
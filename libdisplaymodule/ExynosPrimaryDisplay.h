@@ -1,11 +1,74 @@
 #ifndef EXYNOS_DISPLAY_MODULE_H
 #define EXYNOS_DISPLAY_MODULE_H
 
+#include <sys/system_properties.h>
+
 #include "ExynosOverlayDisplay.h"
 
+struct idma_layer;
+struct idma_cost;
+
+/* what set() compares between frames to find a static scene */
+#define MAX_STATIC_LAYERS 16
+
+struct static_layer_sig {
+    buffer_handle_t handle;
+    int32_t compositionType;
+    uint32_t flags;
+    uint32_t transform;
+    int32_t blending;
+    uint32_t planeAlpha;
+    hwc_frect_t sourceCropf;
+    hwc_rect_t displayFrame;
+    /* signalled acquire fence: first timeline, points, last signal time */
+    char fenceTimeline[32];
+    uint32_t fencePts;
+    uint64_t fenceTimestamp;
+};
+
+/* frames of FB target damage kept, the most buffers SurfaceFlinger cycles through */
+#define FB_DAMAGE_HISTORY 4
+
+struct fb_damage_frame {
+    buffer_handle_t handle;
+    /* false when the frame's damage is unknown */
+    bool valid;
+    hwc_rect_t damage;
+};
+
 class ExynosPrimaryDisplay : public ExynosOverlayDisplay {
         enum decon_idma_type prevfbTargetIdma;
 
+        uint64_t idmaLayerBytes(const struct idma_layer &l, enum decon_idma_type dma);
+        void idmaScore(const struct idma_layer *layers, size_t n,
+                const enum decon_idma_type *dmas, struct idma_cost &cost);
+        void assignIdmaChannels(hwc_display_contents_1_t *contents);
+
+        /* debug.hwc.winupdate, read again only when its serial changes */
+        const prop_info *mWinUpdateProp;
+        uint32_t mWinUpdatePropSerial;
+        uint32_t mWinUpdateAreaSerial;
+        bool mWinUpdateEnabled;
+
+        /* FB target damage of the last frames posted, newest first */
+        struct fb_damage_frame mFbDamage[FB_DAMAGE_HISTORY];
+        size_t mFbDamageFrames;
+
+        bool isWindowUpdateEnabled();
+        bool getGlesDamage(hwc_display_contents_1_t *contents, hwc_rect &damage);
+        bool getFbTargetDamage(hwc_display_contents_1_t *contents, hwc_rect &damage);
+        void recordFbTargetDamage(hwc_display_contents_1_t *contents);
+        uint64_t windowUpdateCost(struct decon_win_config *config, const hwc_rect &rect);
+
+        /* last frame posted to DECON, see isStaticFrame() */
+        struct static_layer_sig mLastFrameSig[MAX_STATIC_LAYERS];
+        size_t mLastFrameLayers;
+        bool mLastFrameValid;
+        int mLastRetireFenceFd;
+
+        bool isStaticFrame(hwc_display_contents_1_t *contents,
+                struct static_layer_sig *sig);
+
     public:
         ExynosPrimaryDisplay(int numGSCs, struct exynos5_hwc_composer_device_1_t *pdev);
         ~ExynosPrimaryDisplay();
@@ -14,6 +77,7 @@ class ExynosPrimaryDisplay : public ExynosOverlayDisplay {
         virtual void forceYuvLayersToFb(hwc_display_contents_1_t *contents);
         virtual int getMPPForUHD(hwc_layer_1_t &layer);
         virtual int getRGBMPPIndex(int index);
+        virtual int set(hwc_display_contents_1_t *contents);
 
         void assignWindows(hwc_display_contents_1_t *contents);
         int postMPPM2M(hwc_layer_1_t &layer, struct decon_win_config *config, int win_map, int index);
@@ -55,3 +55,40 @@ bool ExynosMPPModule::isFormatSupportedByMPP(int format)
     }
     return ExynosMPP::isFormatSupportedByMPP(format);
 }
+
+bool ExynosMPPModule::isBlendSupportedByMPP(hwc_layer_1_t &layer, int dstFormat)
+{
+    private_handle_t *handle = private_handle_t::dynamicCast(layer.handle);
+    int srcW = (int)(layer.sourceCropf.right - layer.sourceCropf.left);
+    int srcH = (int)(layer.sourceCropf.bottom - layer.sourceCropf.top);
+    int dstW = WIDTH(layer.displayFrame);
+    int dstH = HEIGHT(layer.displayFrame);
+
+    if (mType != MPP_MSC && mType != MPP_MSC_1)
+        return false;
+    if (!handle || !isFormatRgb(handle->format))
+        return false;
+    if (!isFormatSupportedByMPP(handle->format) || !isFormatSupportedByMPP(dstFormat))
+        return false;
+
+    /* the blend pass neither rotates nor applies plane alpha */
+    if (layer.transform || layer.planeAlpha != 255)
+        return false;
+
+    if (srcW < MSC_BLEND_MIN_SRC_SIZE || srcH < MSC_BLEND_MIN_SRC_SIZE ||
+            dstW <= 0 || dstH <= 0)
+        return false;
+    if (srcW > dstW * MSC_BLEND_MAX_DOWNSCALE || srcH > dstH * MSC_BLEND_MAX_DOWNSCALE)
+        return false;
+    if (dstW > srcW * MSC_BLEND_MAX_UPSCALE || dstH > srcH * MSC_BLEND_MAX_UPSCALE)
+        return false;
+
+    return true;
+}
+
+size_t ExynosMPPModule::getMaxBlendLayers()
+{
+    if (mType != MPP_MSC && mType != MPP_MSC_1)
+        return 0;
+    return MSC_BLEND_MAX_LAYERS;
+}
@@ -5,12 +5,23 @@
 
 class ExynosDisplay;
 
+/*
+ * Limits of blending RGB layers onto the WFD output with the MSC, one
+ * processM2MWithB pass per layer.
+ */
+#define MSC_BLEND_MAX_LAYERS        4
+#define MSC_BLEND_MAX_DOWNSCALE     4
+#define MSC_BLEND_MAX_UPSCALE       8
+#define MSC_BLEND_MIN_SRC_SIZE      16
+
 class ExynosMPPModule : public ExynosMPP {
     public:
         ExynosMPPModule();
         ExynosMPPModule(ExynosDisplay *display, int gscIndex);
         ExynosMPPModule(ExynosDisplay *display, unsigned int mppType, unsigned int mppIndex);
         virtual bool isFormatSupportedByMPP(int format);
+        bool isBlendSupportedByMPP(hwc_layer_1_t &layer, int dstFormat);
+        size_t getMaxBlendLayers();
     protected:
         virtual int getBufferUsage(private_handle_t *srcHandle);
 };
@@ -105,6 +105,7 @@ void ExynosVirtualDisplayModule::determineSupportedOverlays(hwc_display_contents
     DISPLAY_LOGD("determineSupportedOverlays");
 
     int ret = 0;
+    size_t numRgbOverlays = 0;
     mIsRotationState = false;
     mCompositionType = COMPOSITION_GLES;
     mOverlayLayer = NULL;
@@ -121,6 +122,9 @@ void ExynosVirtualDisplayModule::determineSupportedOverlays(hwc_display_contents
         mExternalMPPDstFormat = h->format;
     }
 
+    if (contents->outbuf && !mHasDrmSurface && !mForceFb)
+        numRgbOverlays = determineRgbOverlays(contents);
+
     /* determine composition type */
     for (size_t i = 0; i < contents->numHwLayers; i++) {
         hwc_layer_1_t &layer = contents->hwLayers[i];
@@ -139,6 +143,9 @@ void ExynosVirtualDisplayModule::determineSupportedOverlays(hwc_display_contents
                     layer.acquireFenceFd, layer.releaseFenceFd, getDrmMode(layer.flags));
         }
 
+        if (i < numRgbOverlays)
+            continue;
+
         if (!mFbNeeded) {
             mFirstFb = i;
             mFbNeeded = true;
@@ -147,6 +154,86 @@ void ExynosVirtualDisplayModule::determineSupportedOverlays(hwc_display_contents
     }
 }
 
+/*
+ * RGB layers at the bottom of the stack go to the MSC, which blends each of
+ * them under the FB target holding the GLES layers above: postFrame copies
+ * the FB target to outbuf, then rewrites each overlay's displayFrame with
+ * the FB target blended over it. A pass doesn't see the overlays below its
+ * layer, so only opaque layers may cover an earlier overlay, and at least
+ * one layer stays on GLES to provide the FB target.
+ */
+size_t ExynosVirtualDisplayModule::determineRgbOverlays(hwc_display_contents_1_t *contents)
+{
+    ExynosMPPModule *externalMPP = mExternalMPPs[WFD_EXT_MPP_IDX];
+    size_t maxLayers = min(externalMPP->getMaxBlendLayers(), (size_t)(NUM_HW_WINDOWS - 1));
+    size_t numLayers = 0;
+    size_t count = 0;
+
+    for (size_t i = 0; i < contents->numHwLayers; i++) {
+        if (contents->hwLayers[i].compositionType != HWC_FRAMEBUFFER_TARGET)
+            numLayers++;
+    }
+
+    for (size_t i = 0; i < numLayers && count < maxLayers; i++) {
+        hwc_layer_1_t &layer = contents->hwLayers[i];
+        ExynosMPPModule *supportedExternalMPP = NULL;
+        bool covered = false;
+
+        if (!layer.handle)
+            break;
+        private_handle_t *h = private_handle_t::dynamicCast(layer.handle);
+        if (!isFormatRgb(h->format) || getDrmMode(h->flags) != NO_DRM)
+            break;
+        if (!isOverlaySupported(layer, i, false, NULL, &supportedExternalMPP))
+            break;
+
+        if (layer.blending != HWC_BLENDING_NONE) {
+            for (size_t j = 0; j < count; j++) {
+                hwc_rect_t r = intersection(layer.displayFrame,
+                        contents->hwLayers[j].displayFrame);
+                if (WIDTH(r) > 0 && HEIGHT(r) > 0) {
+                    covered = true;
+                    break;
+                }
+            }
+            if (covered) {
+                DISPLAY_LOGD("\tlayer %u: translucent over an overlay", i);
+                break;
+            }
+        }
+        count++;
+    }
+
+    if (count == numLayers && count > 0)
+        count--;
+
+    for (size_t i = 0; i < numLayers; i++) {
+        hwc_layer_1_t &layer = contents->hwLayers[i];
+
+        if (i < count) {
+            layer.compositionType = HWC_OVERLAY;
+            mLayerInfos[i]->mExternalMPP = externalMPP;
+            mLayerInfos[i]->mInternalMPP = NULL;
+            mLayerInfos[i]->compositionType = layer.compositionType;
+            mLayerInfos[i]->mWindowIndex = i;
+        } else if (layer.compositionType == HWC_OVERLAY && layer.handle &&
+                isFormatRgb(private_handle_t::dynamicCast(layer.handle)->format)) {
+            /* blended by the MSC last frame */
+            layer.compositionType = HWC_FRAMEBUFFER;
+            mLayerInfos[i]->compositionType = layer.compositionType;
+            mLayerInfos[i]->mExternalMPP = NULL;
+        }
+    }
+
+    if (count > 0) {
+        externalMPP->mState = MPP_STATE_ASSIGNED;
+        externalMPP->setDisplay(this);
+    }
+
+    DISPLAY_LOGD("determineRgbOverlays: %u of %u layers on MSC", count, numLayers);
+    return count;
+}
+
 bool ExynosVirtualDisplayModule::isOverlaySupported(hwc_layer_1_t &layer, size_t index,
         bool useVPPOverlay, ExynosMPPModule **supportedInternalMPP,
         ExynosMPPModule **supportedExternalMPP)
@@ -202,6 +289,11 @@ bool ExynosVirtualDisplayModule::isOverlaySupported(hwc_layer_1_t &layer, size_t
             DISPLAY_LOGD("\tlayer %u: %d ProcessingNotSupported", index, -ret);
             mLayerInfos[index]->mCheckMPPFlag |= -ret;
         }
+    } else if (externalMPP->isBlendSupportedByMPP(layer, mExternalMPPDstFormat)) {
+        *supportedExternalMPP = externalMPP;
+        return true;
+    } else {
+        DISPLAY_LOGD("\tlayer %u: blending not supported by MPP", index);
     }
 
     /* Can't find valid MPP */
@@ -233,7 +325,7 @@ int ExynosVirtualDisplayModule::prepare(hwc_display_contents_1_t *contents)
         hwc_layer_1_t &layer = contents->hwLayers[i];
 
         if (layer.compositionType == HWC_FRAMEBUFFER) {
-            if (!layer.handle)
+            if (layer.handle)
                 mNumFB++;
             goto cont;
         }
@@ -463,6 +555,7 @@ int ExynosVirtualDisplayModule::postFrame(hwc_display_contents_1_t *contents)
     int ret = -1;
     int win_map = 0;
     int tot_ovly_wins = 0;
+    bool chained = false;
     private_handle_t *handle_op, *h;
 
     memset(mLastHandles, 0, sizeof(mLastHandles));
@@ -493,13 +586,16 @@ int ExynosVirtualDisplayModule::postFrame(hwc_display_contents_1_t *contents)
                 mLastMPPMap[window_index].external_mpp.type = mLayerInfos[i]->mExternalMPP->mType;
                 mLastMPPMap[window_index].external_mpp.index = mLayerInfos[i]->mExternalMPP->mIndex;
 
-                ret = postToMPP(layer, mFBTargetLayer, i, contents);
+                ret = postToMPP(layer, mFBTargetLayer, i, contents, chained);
                 if (ret < 0) {
                     DISPLAY_LOGE("postToMPP failed in extended/drm mode.");
                 }
                 mLayerInfos[i]->mExternalMPP->mCurrentBuf =
                     (mLayerInfos[i]->mExternalMPP->mCurrentBuf + 1)%
                     mLayerInfos[i]->mExternalMPP->mNumAvailableDstBuffers;
+                if (ret < 0)
+                    break;
+                chained = true;
             }
         }
     }
@@ -507,8 +603,12 @@ int ExynosVirtualDisplayModule::postFrame(hwc_display_contents_1_t *contents)
     return ret;
 }
 
+/*
+ * chained: an earlier pass of this frame already wrote outbuf, so this one
+ * only blends layer under layerB within its displayFrame once that pass is done.
+ */
 int ExynosVirtualDisplayModule::postToMPP(hwc_layer_1_t &layer, hwc_layer_1_t *layerB,
-        int index, hwc_display_contents_1_t *contents)
+        int index, hwc_display_contents_1_t *contents, bool chained)
 {
     int dst_format = mExternalMPPDstFormat;
     private_handle_t *handle = private_handle_t::dynamicCast(layer.handle);
@@ -529,10 +629,17 @@ int ExynosVirtualDisplayModule::postToMPP(hwc_layer_1_t &layer, hwc_layer_1_t *l
     }
 
     exynosMPP->mDstBuffers[exynosMPP->mCurrentBuf] = contents->outbuf;
-    exynosMPP->mDstBufFence[exynosMPP->mCurrentBuf] = contents->outbufAcquireFenceFd;
+    if (chained) {
+        exynosMPP->mDstBufFence[exynosMPP->mCurrentBuf] = exynosMPP->mDstConfig.releaseFenceFd;
+        exynosMPP->mDstConfig.releaseFenceFd = -1;
+    } else {
+        exynosMPP->mDstBufFence[exynosMPP->mCurrentBuf] = contents->outbufAcquireFenceFd;
+    }
 
     if (layerB) {
-        if (is2StepBlendingRequired(layer, contents->outbuf)) {
+        if (chained) {
+            DISPLAY_LOGD("Performing chained blending operation");
+        } else if (is2StepBlendingRequired(layer, contents->outbuf)) {
             private_handle_t *handleB = private_handle_t::dynamicCast(layerB->handle);
             hwc_frect_t sourceCropB = { 0, 0,
                     (float)WIDTH(layerB->displayFrame), (float)HEIGHT(layerB->displayFrame) };
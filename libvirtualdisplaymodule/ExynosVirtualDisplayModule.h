@@ -10,7 +10,8 @@ class ExynosVirtualDisplayModule : public ExynosVirtualDisplay {
 
 		int postFrame(hwc_display_contents_1_t *contents);
 		int postToMPP(hwc_layer_1_t & layer, hwc_layer_1_t *layerB,
-						int index, hwc_display_contents_1_t *contents);
+						int index, hwc_display_contents_1_t *contents, bool chained);
+		size_t determineRgbOverlays(hwc_display_contents_1_t *contents);
 		void processGles(hwc_display_contents_1_t *contents);
 		void processHwc(hwc_display_contents_1_t *contents);
 		void processMixed(hwc_display_contents_1_t *contents);